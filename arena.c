@@ -0,0 +1,52 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void arena_init(Arena* arena) {
+    arena->head = NULL;
+}
+
+void arena_free(Arena* arena) {
+    while(arena->head != NULL) {
+        ArenaBlock* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+
+void arena_reset(Arena* arena) {
+    if(arena->head == NULL)
+        return;
+
+    ArenaBlock* head = arena->head;
+    arena->head = head->next;
+    arena_free(arena);
+    head->next = NULL;
+    head->used = 0;
+    arena->head = head;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    ArenaBlock* head = arena->head;
+    if(head == NULL || head->used + size > head->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        head = malloc(sizeof(ArenaBlock) + block_size);
+        head->next = arena->head;
+        head->size = block_size;
+        head->used = 0;
+        arena->head = head;
+    }
+
+    void* memory = head->data + head->used;
+    head->used += size;
+    return memory;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
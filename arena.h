@@ -0,0 +1,14 @@
+#ifndef MYSHELL_ARENA_H
+#define MYSHELL_ARENA_H
+
+#include "typedefs.h"
+
+#include <stddef.h>
+
+void arena_init(Arena* arena);
+void arena_free(Arena* arena);
+void arena_reset(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strndup(Arena* arena, const char* str, size_t length);
+
+#endif //MYSHELL_ARENA_H
@@ -0,0 +1,127 @@
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static char source_path[DIRECTORY_MAX_LENGTH];
+static char target_path[DIRECTORY_MAX_LENGTH];
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// The 512-byte loop cpcat used before, as the baseline.
+static int copy_small(int input_fd, int output_fd) {
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_read;
+    while((bytes_read = read(input_fd, buffer, BUFFER_SIZE)) > 0)
+        if(write(output_fd, buffer, bytes_read) != bytes_read)
+            return -1;
+
+    return 0;
+}
+
+static pid_t start_drain(int fd, int write_fd) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(write_fd);
+        char* buffer = malloc(1 << 20);
+        while(read(fd, buffer, 1 << 20) > 0);
+        _exit(0);
+    }
+
+    close(fd);
+    return pid;
+}
+
+static pid_t start_feed(int fd, size_t size) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        char* buffer = calloc(1, 1 << 20);
+        for(size_t left = size; left > 0;) {
+            ssize_t written = write(fd, buffer, left < (1 << 20) ? left : (1 << 20));
+            if(written <= 0)
+                _exit(1);
+
+            left -= written;
+        }
+
+        _exit(0);
+    }
+
+    close(fd);
+    return pid;
+}
+
+static double run(const char* pair, int (* copy)(int, int), size_t size) {
+    int input_fd;
+    int output_fd;
+    int fds[2];
+    pid_t helper = -1;
+    if(strcmp(pair, "pipe->file") == 0) {
+        pipe(fds);
+        helper = start_feed(fds[1], size);
+        input_fd = fds[0];
+    } else {
+        input_fd = open(source_path, O_RDONLY);
+    }
+
+    if(strcmp(pair, "file->pipe") == 0) {
+        pipe(fds);
+        helper = start_drain(fds[0], fds[1]);
+        output_fd = fds[1];
+    } else {
+        output_fd = open(target_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(copy(input_fd, output_fd) == -1)
+        perror(pair);
+
+    close(output_fd);
+    if(helper != -1)
+        waitpid(helper, NULL, 0);
+
+    double seconds = elapsed_seconds(&start);
+    close(input_fd);
+    return seconds;
+}
+
+// Usage: cpcat_bench [directory] [largest size in MB]
+int main(int argc, char** argv) {
+    const char* directory = argc > 1 ? argv[1] : "/tmp";
+    size_t largest = (argc > 2 ? strtoul(argv[2], NULL, 10) : 256) << 20;
+    snprintf(source_path, sizeof(source_path), "%s/cpcat_bench.src", directory);
+    snprintf(target_path, sizeof(target_path), "%s/cpcat_bench.dst", directory);
+
+    static const char* pairs[] = {"file->file", "file->pipe", "pipe->file"};
+    for(size_t size = 1 << 20; size <= largest; size *= 16) {
+        int fd = open(source_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        char* block = malloc(1 << 20);
+        for(size_t written = 0; written < size; written += 1 << 20) {
+            memset(block, (int) (written >> 20), 1 << 20);
+            write(fd, block, 1 << 20);
+        }
+
+        free(block);
+        close(fd);
+        for(int p = 0; p < 3; ++p) {
+            double baseline = run(pairs[p], copy_small, size);
+            double seconds = run(pairs[p], copy_data, size);
+            printf("%6zu MB %-11s read/write %8.0f MB/s   copy_data %8.0f MB/s\n", size >> 20, pairs[p],
+                   (size >> 20) / baseline, (size >> 20) / seconds);
+        }
+    }
+
+    unlink(source_path);
+    unlink(target_path);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "shell.h"
+
+#include <time.h>
+
+Shell* sh;
+
+static void* find_builtin_linear(char* cmd) {
+    for(int c = 0; c < NUM_COMMANDS; ++c)
+        if(strcmp(commands[c].name, cmd) == 0)
+            return commands[c].function;
+
+    return NULL;
+}
+
+static void measure(char* label, void* (* find)(char*), char** names, int name_count, long iterations) {
+    struct timespec start;
+    struct timespec end;
+    long found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < iterations; ++i)
+        found += find(names[i % name_count]) != NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-22s %12.0f lookups/sec (%ld found)\n", label, iterations / seconds, found);
+}
+
+// Usage: dispatch_bench [iterations]
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 20000000;
+    char* builtins[] = {"echo", "setvar", "cpcat", "varlist", "pinfo", "dirls", "sum", "history"};
+    char* externals[] = {"ls", "grep", "gcc", "make", "python3", "sed", "awk", "git"};
+    int builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+    int external_count = sizeof(externals) / sizeof(externals[0]);
+
+    measure("linear, builtins", find_builtin_linear, builtins, builtin_count, iterations);
+    measure("linear, externals", find_builtin_linear, externals, external_count, iterations);
+    measure("dispatch, builtins", find_builtin, builtins, builtin_count, iterations);
+    measure("dispatch, externals", find_builtin, externals, external_count, iterations);
+    return 0;
+}
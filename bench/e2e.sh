@@ -0,0 +1,288 @@
+#!/bin/bash
+
+# End-to-end throughput of my_shell running generated scripts non-interactively.
+#
+# Usage: bench/e2e.sh [-x shell] [-n commands] [-r runs] [-p processes] [-m cpcat MB] [-o results.json]
+#                     [-b baseline.json] [-t threshold %] [-N] [-R]
+#
+# Each workload is run -r times and the fastest run counts. Results are written as JSON to -o, along with the
+# parameters and the machine they were measured on. Every workload slower than the baseline by more than the
+# threshold is reported and the script exits with 1, as it does when a shell fails on a workload. A missing
+# baseline, or one measured with other parameters, is an error unless -N skips the comparison. The baseline
+# is only an earlier results file, so `-N -o bench/e2e-baseline.json` on a known good build stores one.
+# -R also runs the sh versions of the workloads under dash and bash, where installed.
+
+shell=./my_shell
+commands=20000
+runs=3
+processes=5000
+cpcat_mb=256
+results=build/e2e.json
+baseline=bench/e2e-baseline.json
+threshold=10
+reference=0
+compare=1
+
+while getopts "x:n:r:p:m:o:b:t:NR" option; do
+    case $option in
+        x) shell=$OPTARG ;;
+        n) commands=$OPTARG ;;
+        r) runs=$OPTARG ;;
+        p) processes=$OPTARG ;;
+        m) cpcat_mb=$OPTARG ;;
+        o) results=$OPTARG ;;
+        b) baseline=$OPTARG ;;
+        t) threshold=$OPTARG ;;
+        N) compare=0 ;;
+        R) reference=1 ;;
+        *) exit 2 ;;
+    esac
+done
+
+if [ ! -x "$shell" ]; then
+    echo "e2e: $shell is not executable" >&2
+    exit 2
+fi
+
+if ((compare)) && [ ! -f "$baseline" ]; then
+    echo "e2e: no baseline at $baseline; store one with -N -o $baseline on a known good build" >&2
+    exit 2
+fi
+
+work=$(mktemp -d /tmp/mysh_e2e.XXXXXX)
+trap 'rm -rf "$work"' EXIT
+
+# A procfs lookalike with the stat line format the scanner expects, including names with spaces and parens.
+make_procfs() {
+    mkdir -p "$work/proc"
+    for ((pid = 1; pid <= processes; ++pid)); do
+        mkdir "$work/proc/$pid"
+        if ((pid % 7 == 0)); then name="worker (x) $pid"; else name="proc$pid"; fi
+        echo "$pid ($name) S $((pid / 2)) $pid $pid 0 -1 4194560 1320 0 0 0 $((pid % 100)) $((pid % 50)) 0 0" \
+             "20 0 1 0 $pid 8445952 $((pid % 900))" > "$work/proc/$pid/stat"
+    done
+}
+
+# Every workload is a pair of scripts: the my_shell one and, when the work can be expressed in sh, its
+# counterpart for the reference shells. The first line of each is the number of operations it performs.
+generate() {
+    local lines=$commands
+    {
+        echo "$lines"
+        for ((i = 0; i < lines; i += 5)); do
+            echo "sum 1 2 3 $i"
+            echo "len argument-$i"
+            echo "setvar name=value$i"
+            echo "echo \$name"
+            echo "basename /usr/share/doc/file$i.txt"
+        done
+    } > "$work/builtins.mysh"
+    {
+        echo "$lines"
+        for ((i = 0; i < lines; i += 5)); do
+            echo "echo \$((1 + 2 + 3 + $i))"
+            echo "x=argument-$i; echo \${#x}"
+            echo "name=value$i"
+            echo "echo \$name"
+            echo "x=/usr/share/doc/file$i.txt; echo \${x##*/}"
+        done
+    } > "$work/builtins.sh"
+
+    lines=$((commands / 10))
+    {
+        echo "$lines"
+        for ((i = 0; i < lines; i += 2)); do
+            echo "/bin/true"
+            echo "/bin/echo word $i"
+        done
+    } | tee "$work/externals.sh" > "$work/externals.mysh"
+
+    {
+        echo "$lines"
+        for ((i = 0; i < lines; i += 4)); do
+            echo "echo a b c $i | cpcat | cpcat"
+            echo "pipes \"echo stage $i\" \"cpcat\""
+            echo "/bin/echo external $i | /bin/cat"
+            echo "echo mixed $i | /bin/cat | cpcat"
+        done
+    } > "$work/pipelines.mysh"
+    {
+        echo "$lines"
+        for ((i = 0; i < lines; i += 4)); do
+            echo "echo a b c $i | cat | cat"
+            echo "echo stage $i | cat"
+            echo "/bin/echo external $i | /bin/cat"
+            echo "echo mixed $i | /bin/cat | cat"
+        done
+    } > "$work/pipelines.sh"
+
+    lines=$((commands / 500 + 2))
+    {
+        echo "$((lines * processes))"
+        echo "proc $work/proc"
+        for ((i = 0; i < lines; i += 2)); do
+            echo "pids"
+            echo "pinfo"
+        done
+    } > "$work/procfs.mysh"
+
+    head -c $((cpcat_mb << 20)) /dev/urandom > "$work/source"
+    {
+        echo "$((cpcat_mb * 3))"
+        for i in 1 2 3; do
+            echo "cpcat $work/source $work/target"
+        done
+    } > "$work/cpcat.mysh"
+    {
+        echo "$((cpcat_mb * 3))"
+        for i in 1 2 3; do
+            echo "cat $work/source > $work/target"
+        done
+    } > "$work/cpcat.sh"
+}
+
+# Prints "operations seconds failed" for the fastest of the runs. A run that exits with an error fails the
+# workload, since a shell that crashed early would otherwise look faster.
+measure() {
+    local runner=$1 script=$2 best="" failed=0
+    local operations
+    operations=$(head -n 1 "$script")
+    tail -n +2 "$script" > "$script.body"
+    for ((run = 0; run < runs; ++run)); do
+        local start end
+        start=$(date +%s%N)
+        if ! "$runner" "$script.body" > /dev/null 2> "$work/stderr"; then
+            echo "e2e: $runner failed on $(basename "$script")" >&2
+            failed=1
+        fi
+
+        end=$(date +%s%N)
+        if [ -s "$work/stderr" ]; then
+            echo "e2e: $runner $(basename "$script"): $(head -n 3 "$work/stderr")" >&2
+        fi
+
+        if [ -z "$best" ] || ((end - start < best)); then
+            best=$((end - start))
+        fi
+    done
+
+    echo "$operations $(awk "BEGIN { printf \"%.6f\", $best / 1e9 }") $failed"
+}
+
+# One workload per line, so the baseline can be read back without a JSON parser.
+entry() {
+    local indent=$1 name=$2 unit=$3 operations=$4 seconds=$5 failed=$6 last=$7
+    awk -v i="$indent" -v n="$name" -v u="$unit" -v o="$operations" -v s="$seconds" -v f="$failed" -v l="$last" '
+    BEGIN {
+        printf "%s\"%s\": {\"unit\": \"%s\", \"rate\": %.1f, \"operations\": %d, \"seconds\": %.6f%s}%s\n",
+               i, n, u, o / s, o, s, f ? ", \"failed\": true" : "", l ? "" : ","
+    }'
+}
+
+unit_of() {
+    case $1 in
+        procfs) echo "processes/s" ;;
+        cpcat) echo "MB/s" ;;
+        *) echo "commands/s" ;;
+    esac
+}
+
+workloads="builtins externals pipelines procfs cpcat"
+parameters="{\"commands\": $commands, \"runs\": $runs, \"processes\": $processes, \"cpcat_mb\": $cpcat_mb}"
+cpu=$(sed -n 's/^model name[[:space:]]*: //p' /proc/cpuinfo | head -n 1)
+machine="$(uname -srm), $(nproc) CPUs${cpu:+, $cpu}"
+failures=""
+generate
+make_procfs
+
+{
+    echo "{"
+    echo "  \"shell\": \"$shell\","
+    echo "  \"date\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+    echo "  \"machine\": \"$machine\","
+    echo "  \"parameters\": $parameters,"
+    echo "  \"results\": {"
+    total=$(echo $workloads | wc -w)
+    count=0
+    for workload in $workloads; do
+        read -r operations seconds failed < <(measure "$shell" "$work/$workload.mysh")
+        ((failed)) && failures="$failures $workload"
+        entry "    " "$workload" "$(unit_of "$workload")" "$operations" "$seconds" "$failed" $((++count == total))
+    done
+
+    echo -n "  }"
+    if ((reference)); then
+        echo ","
+        echo "  \"reference\": {"
+        shells=""
+        for candidate in dash bash; do
+            command -v $candidate > /dev/null && shells="$shells $candidate"
+        done
+
+        remaining=$(echo $shells | wc -w)
+        for candidate in $shells; do
+            echo "    \"$candidate\": {"
+            scripts=$(cd "$work" && ls *.sh | sed 's/\.sh$//')
+            total=$(echo $scripts | wc -w)
+            count=0
+            for workload in $scripts; do
+                read -r operations seconds failed < <(measure "$(command -v $candidate)" "$work/$workload.sh")
+                ((failed)) && failures="$failures $candidate/$workload"
+                entry "      " "$workload" "$(unit_of "$workload")" "$operations" "$seconds" "$failed" \
+                      $((++count == total))
+            done
+
+            echo -n "    }"
+            (( --remaining > 0 )) && echo "," || echo
+        done
+
+        echo -n "  }"
+    fi
+
+    echo
+    echo "}"
+} > "$work/results.json"
+
+mkdir -p "$(dirname "$results")"
+cp "$work/results.json" "$results"
+cat "$results"
+
+status=0
+if [ -n "$failures" ]; then
+    echo "e2e: failed:$failures" >&2
+    status=1
+fi
+
+((compare)) || exit $status
+
+measured=$(sed -n 's/^  "parameters": \(.*\),$/\1/p' "$baseline")
+if [ "$measured" != "$parameters" ]; then
+    echo "e2e: $baseline was measured with other parameters: $measured" >&2
+    exit 2
+fi
+
+# Failed workloads are left out, since their rates mean nothing.
+rates() {
+    grep -v '"failed": true' "$1" |
+        sed -n 's/^    "\([a-z]*\)": {"unit": "\([^"]*\)", "rate": \([0-9.]*\).*/\1 \3 \2/p'
+}
+
+echo
+echo "against $baseline (threshold $threshold%):"
+while read -r workload rate unit; do
+    previous=$(rates "$baseline" | awk -v w="$workload" '$1 == w { print $2 }')
+    if [ -z "$previous" ]; then
+        printf "  %-10s %12s %-11s new\n" "$workload" "$rate" "$unit"
+        continue
+    fi
+
+    verdict=$(awk -v r="$rate" -v p="$previous" -v t="$threshold" 'BEGIN {
+        change = (r - p) / p * 100
+        verdict = change < -t ? "REGRESSION" : (change > t ? "faster" : "ok")
+        printf "%+6.1f%% %s", change, verdict
+    }')
+    printf "  %-10s %12s %-11s %s\n" "$workload" "$rate" "$unit" "$verdict"
+    [[ $verdict == *REGRESSION ]] && status=1
+done < <(rates "$results")
+
+exit $status
@@ -0,0 +1,62 @@
+#include "jobs.h"
+#include "spawner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Every job exits with its index modulo 256, so a lost or misattributed status shows up as a mismatch.
+static pid_t spawn_job(int index) {
+    char script[32];
+    snprintf(script, sizeof(script), "exit %d", index % 256);
+    char* argv[] = {"/bin/sh", "-c", script, NULL};
+    pid_t pid = spawn_process(argv[0], argv, -1, -1);
+    if(pid == -1) {
+        perror("spawn");
+        exit(1);
+    }
+
+    return pid;
+}
+
+// Usage: jobs_bench [jobs]
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+    JobTable table;
+    job_table_init(&table);
+    Job** jobs = malloc(count * sizeof(Job*));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int j = 0; j < count; ++j) {
+        pid_t pid = spawn_job(j);
+        jobs[j] = job_start(&table, "exit", &pid, 1);
+    }
+
+    double started = elapsed_seconds(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long polls = 0;
+    while(table.running > 0) {
+        job_table_poll(&table, -1);
+        ++polls;
+    }
+
+    double reaped = elapsed_seconds(&start);
+    int wrong = 0;
+    for(int j = 0; j < count; ++j)
+        wrong += jobs[j]->status != j % 256;
+
+    printf("%d jobs started in %.3fs, reaped in %.3fs with %ld polls, %d unwatched, %d wrong statuses\n", count,
+           started, reaped, polls, table.unwatched, wrong);
+    job_table_free(&table);
+    free(jobs);
+    return wrong != 0;
+}
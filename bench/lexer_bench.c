@@ -0,0 +1,60 @@
+#include "shell.h"
+#include "table.h"
+#include "lexer.h"
+
+#include <time.h>
+
+Shell* sh;
+
+static char* make_line(const char* word, size_t length) {
+    size_t word_length = strlen(word);
+    char* line = malloc(length + word_length + 1);
+    size_t used = 0;
+    while(used < length) {
+        memcpy(line + used, word, word_length);
+        used += word_length;
+    }
+
+    line[length] = '\0';
+    return line;
+}
+
+// Usage: lexer_bench [total MB per case]
+int main(int argc, char** argv) {
+    size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+    sh = start_shell();
+    table_insert(&sh->variables, "file", 4)->value = strdup("input.txt");
+
+    static const char* cases[][2] = {
+            {"long words", "/usr/share/doc/some-package/changelog.Debian.gz "},
+            {"short words", "a bc d ef "},
+            {"quoted", "\"a long quoted argument with spaces\" "},
+            {"variables", "$file x$file "},
+    };
+    static const char* scanners[] = {"scalar", "sse2", "avx2"};
+
+    size_t length = 64 << 10;
+    for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        char* line = make_line(cases[c][1], length);
+        long iterations = total / length;
+        for(int level = SCAN_SCALAR; level <= SCAN_AVX2; ++level) {
+            if(select_scanner(level) != level)
+                continue;
+
+            struct timespec start;
+            struct timespec end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(long i = 0; i < iterations; ++i)
+                tokenize(line);
+
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+            printf("%-12s %-7s %8d tokens %8.1f MB/s\n", cases[c][0], scanners[level], sh->token_count,
+                   (double) length * iterations / seconds / (1 << 20));
+        }
+
+        free(line);
+    }
+
+    return 0;
+}
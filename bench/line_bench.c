@@ -0,0 +1,43 @@
+#include "shell.h"
+#include "table.h"
+
+#include <time.h>
+
+Shell* sh;
+
+static char* make_line(size_t length) {
+    static const char* words[] = {"cpcat", "$file", "-v", "\"quoted words\"", "$dir/src.c", "plain"};
+    char* line = malloc(length + 32);
+    size_t used = 0;
+    for(int w = 0; used < length; ++w)
+        used += sprintf(line + used, "%s ", words[w % 6]);
+
+    line[length] = '\0';
+    return line;
+}
+
+// Usage: line_bench [total MB per size]
+int main(int argc, char** argv) {
+    size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+    sh = start_shell();
+    table_insert(&sh->variables, "file", 4)->value = strdup("input.txt");
+    table_insert(&sh->variables, "dir", 3)->value = strdup("/home/user/project");
+
+    for(size_t length = 10; length <= 1 << 20; length *= 10) {
+        char* line = make_line(length);
+        long iterations = total / length;
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(long i = 0; i < iterations; ++i)
+            tokenize(line);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%8zu bytes %8d tokens %12.0f ns/line %8.1f MB/s\n", length, sh->token_count, seconds * 1e9 / iterations,
+               (double) length * iterations / seconds / (1 << 20));
+        free(line);
+    }
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "shell.h"
+#include "output.h"
+#include "table.h"
+#include "lexer.h"
+#include "utility.h"
+
+#include <time.h>
+
+#define SNAPSHOT_TOKENS 64
+#define BENCH_LINE_SIZE 256
+
+Shell* sh;
+
+typedef struct {
+    char* tokens[SNAPSHOT_TOKENS];
+    unsigned char kinds[SNAPSHOT_TOKENS];
+    int count;
+    size_t line_used;
+} TokenSnapshot;
+
+typedef struct {
+    int input_fd;
+    int output_fd;
+} CopyCase;
+
+static double seconds_per_case;
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Batches grow until one takes long enough to time reliably; the short ones before it double as warm-up.
+static double measure(const char* label, void (* operation)(void*), void* argument) {
+    for(long iterations = 1;;) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(long i = 0; i < iterations; ++i)
+            operation(argument);
+
+        double seconds = elapsed_seconds(&start);
+        if(seconds >= seconds_per_case) {
+            double ns = seconds * 1e9 / iterations;
+            printf("%-36s %10.1f ns/op\n", label, ns);
+            return ns;
+        }
+
+        iterations = seconds > 1e-3 ? (long) (iterations * seconds_per_case / seconds * 1.1) + 1 : iterations * 10;
+    }
+}
+
+static void run_tokenize(void* line) {
+    tokenize(line);
+}
+
+static void take_snapshot(TokenSnapshot* snapshot) {
+    snapshot->count = sh->token_count;
+    snapshot->line_used = sh->line.used;
+    memcpy(snapshot->tokens, sh->tokens, (sh->token_count + 1) * sizeof(char*));
+    memcpy(snapshot->kinds, sh->token_kinds, sh->token_count);
+}
+
+// map_aliases rewrites the tokens in place, so every run starts from the line as the lexer left it.
+static void run_map_aliases(void* argument) {
+    TokenSnapshot* snapshot = argument;
+    sh->token_count = snapshot->count;
+    sh->line.used = snapshot->line_used;
+    memcpy(sh->tokens, snapshot->tokens, (snapshot->count + 1) * sizeof(char*));
+    memcpy(sh->token_kinds, snapshot->kinds, snapshot->count);
+    map_aliases();
+}
+
+static void run_find_builtin(void* names) {
+    static size_t next;
+    char** list = names;
+    if(list[next] == NULL)
+        next = 0;
+
+    find_builtin(list[next++]);
+}
+
+static void run_save_to_history(void* line) {
+    save_to_history(line);
+}
+
+static void run_copy_data(void* argument) {
+    CopyCase* copy = argument;
+    lseek(copy->input_fd, 0, SEEK_SET);
+    lseek(copy->output_fd, 0, SEEK_SET);
+    if(copy_data(copy->input_fd, copy->output_fd) == -1)
+        perror("copy_data");
+}
+
+static void bench_copy(const char* label, size_t size, const char* target) {
+    char source_path[] = "/tmp/micro_bench.XXXXXX";
+    CopyCase copy = {mkstemp(source_path), open(target, O_WRONLY | O_CREAT, 0644)};
+    char* data = malloc(size);
+    for(size_t i = 0; i < size; ++i)
+        data[i] = (char) ('a' + i % 26);
+
+    if(copy.input_fd == -1 || copy.output_fd == -1 || write(copy.input_fd, data, size) != (ssize_t) size) {
+        perror(label);
+    } else {
+        measure(label, run_copy_data, &copy);
+    }
+
+    free(data);
+    close(copy.input_fd);
+    close(copy.output_fd);
+    unlink(source_path);
+}
+
+static void define(const char* command) {
+    char line[BENCH_LINE_SIZE];
+    snprintf(line, sizeof(line), "%s", command);
+    execute_line(line);
+}
+
+// Usage: micro_bench [seconds per case]
+int main(int argc, char** argv) {
+    seconds_per_case = argc > 1 ? atof(argv[1]) : 0.25;
+    sh = start_shell();
+    output_set_fd(&sh->output, open("/dev/null", O_WRONLY));
+
+    printf("tokenize\n");
+    measure("  short command", run_tokenize, "ls -la /tmp");
+    measure("  compiler invocation", run_tokenize,
+            "gcc -O2 -Wall -o my_shell main.c shell.c utility.c lexer.c -I. -pthread > build.log");
+    measure("  quoted arguments", run_tokenize, "echo \"a quoted argument\" \"with  two  spaces\" plain");
+    measure("  three stage pipeline", run_tokenize, "cat access.log | grep -v 404 | sort -u > report.txt");
+
+    // Expansion happens inside the lexer, so its cost is the difference to the already expanded line.
+    define("setvar dir=/usr/share/doc");
+    define("setvar file=changelog.Debian.gz");
+    define("setvar ext=bak");
+    printf("expand_variables\n");
+    double expanded = measure("  5 variables", run_tokenize, "cp $dir/$file $dir/backup/$file.$ext");
+    double literal = measure("  same line, expanded by hand", run_tokenize,
+                             "cp /usr/share/doc/changelog.Debian.gz /usr/share/doc/backup/changelog.Debian.gz.bak");
+    printf("%-36s %10.1f ns/op\n", "  per variable", (expanded - literal) / 5);
+
+    static const char* aliases[][2] = {
+            {"ls -l --color=auto", "ll"}, {"ls -la", "la"}, {"git status --short", "gs"}, {"git diff", "gd"},
+            {"grep --color=auto", "g"}, {"make -j4", "mk"}, {"cd ..", "up"}, {"ll -h", "lh"},
+    };
+    char line[BENCH_LINE_SIZE];
+    for(size_t a = 0; a < sizeof(aliases) / sizeof(aliases[0]); ++a) {
+        snprintf(line, sizeof(line), "alias \"%s\" %s", aliases[a][0], aliases[a][1]);
+        execute_line(line);
+    }
+
+    printf("map_aliases (8 aliases defined)\n");
+    static const char* alias_cases[][2] = {
+            {"  no alias", "gcc -c shell.c"},
+            {"  one alias", "gs -- shell.c"},
+            {"  chained aliases", "lh /usr/share/doc"},
+    };
+    TokenSnapshot snapshot;
+    for(size_t c = 0; c < sizeof(alias_cases) / sizeof(alias_cases[0]); ++c) {
+        snprintf(line, sizeof(line), "%s", alias_cases[c][1]);
+        tokenize(line);
+        take_snapshot(&snapshot);
+        measure(alias_cases[c][0], run_map_aliases, &snapshot);
+    }
+
+    printf("find_builtin\n");
+    char* builtins[] = {"echo", "setvar", "cpcat", "varlist", "pinfo", "dirls", "sum", "history", NULL};
+    char* externals[] = {"ls", "grep", "gcc", "make", "python3", "sed", "awk", "git", NULL};
+    measure("  builtins", run_find_builtin, builtins);
+    measure("  externals", run_find_builtin, externals);
+
+    printf("save_to_history (%zu entries kept)\n", sh->history.capacity);
+    measure("  short line", run_save_to_history, "ls -la");
+    measure("  long line", run_save_to_history,
+            "gcc -O2 -Wall -Wextra -o my_shell main.c shell.c utility.c spawner.c lexer.c table.c -I. -pthread");
+
+    printf("copy_data\n");
+    bench_copy("  4 KB file to /dev/null", 4 << 10, "/dev/null");
+    bench_copy("  1 MB file to /dev/null", 1 << 20, "/dev/null");
+    bench_copy("  1 MB file to file", 1 << 20, "/tmp/micro_bench.out");
+    unlink("/tmp/micro_bench.out");
+    return 0;
+}
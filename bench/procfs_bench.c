@@ -0,0 +1,117 @@
+#include "shell.h"
+#include "output.h"
+#include "procscan.h"
+
+#include <time.h>
+
+Shell* sh;
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void make_procfs(const char* root, int count) {
+    char path[DIRECTORY_MAX_LENGTH];
+    mkdir(root, 0755);
+    for(int pid = 1; pid <= count; ++pid) {
+        snprintf(path, sizeof(path), "%s/%d", root, pid);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/%d/stat", root, pid);
+        FILE* file = fopen(path, "w");
+        fprintf(file, "%d (%s %d) S %d %d %d 0 -1 4194560 1320 0 0 0 %d %d 0 0 20 0 1 0 %d 8445952 %d\n", pid,
+                pid % 7 == 0 ? "worker (x)" : "proc", pid, pid / 2, pid, pid, pid % 100, pid % 50, pid, pid % 900);
+        fclose(file);
+    }
+}
+
+// The way pinfo read every process before the scanner: a formatted path, stdio and sscanf per PID.
+static size_t scan_with_stdio(PidList* pids, ProcessInfo** processes) {
+    char filename[DIRECTORY_MAX_LENGTH];
+    char line[PROC_STAT_BUFFER_SIZE];
+    list_pids(sh->procfs_path, pids);
+    *processes = realloc(*processes, pids->count * sizeof(ProcessInfo));
+    size_t count = 0;
+    for(size_t p = 0; p < pids->count; ++p) {
+        snprintf(filename, sizeof(filename), "%s/%d/stat", sh->procfs_path, pids->pids[p]);
+        FILE* file = fopen(filename, "r");
+        if(file == NULL)
+            continue;
+
+        if(fgets(line, sizeof(line), file) != NULL) {
+            ProcessInfo* info = &(*processes)[count++];
+            sscanf(line, "%d %63s %c %d", &info->pid, info->name, &info->state, &info->ppid);
+        }
+
+        fclose(file);
+    }
+
+    return count;
+}
+
+// Usage: procfs_bench [directory] [processes]
+int main(int argc, char** argv) {
+    const char* root = argc > 1 ? argv[1] : "/tmp/mysh_procfs";
+    int count = argc > 2 ? atoi(argv[2]) : 50000;
+    sh = start_shell();
+    strcpy(sh->procfs_path, root);
+    output_set_fd(&sh->output, open("/dev/null", O_WRONLY));
+
+    struct stat root_stat;
+    if(stat(root, &root_stat) == -1) {
+        printf("creating %d processes under %s\n", count, root);
+        make_procfs(root, count);
+    }
+
+    struct timespec start;
+    PidList pids = {NULL, 0, 0};
+    ProcessInfo* processes = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t scanned = scan_with_stdio(&pids, &processes);
+    printf("%-22s %8zu processes %10.0f processes/sec\n", "fopen+sscanf", scanned, scanned / elapsed_seconds(&start));
+
+    ProcessList list;
+    process_list_init(&list);
+    for(int threads = 1; threads <= 4; threads *= 2) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        scan_processes(sh->procfs_path, &list, threads, NULL);
+        char label[32];
+        snprintf(label, sizeof(label), "scan_processes x%d", threads);
+        printf("%-22s %8zu processes %10.0f processes/sec\n", label, list.count, list.count / elapsed_seconds(&start));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pinfo_handler();
+    printf("%-22s %8zu processes %10.0f processes/sec\n", "pinfo", list.count, list.count / elapsed_seconds(&start));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pids_handler();
+    printf("%-22s %8zu processes %10.0f processes/sec\n", "pids", pids.count, pids.count / elapsed_seconds(&start));
+
+    // pids > file as typed, against the fprintf() per PID pids made before it had the output writer.
+    char target[DIRECTORY_MAX_LENGTH];
+    snprintf(target, sizeof(target), "%s.pids", root);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    list_pids(sh->procfs_path, &pids);
+    FILE* file = fopen(target, "w");
+    for(size_t p = 0; p < pids.count; ++p)
+        fprintf(file, "%d\n", pids.pids[p]);
+
+    fclose(file);
+    printf("%-22s %8zu processes %10.0f processes/sec\n", "pids > file, fprintf", pids.count,
+           pids.count / elapsed_seconds(&start));
+
+    char line[DIRECTORY_MAX_LENGTH + 8];
+    snprintf(line, sizeof(line), "pids >%s", target);
+    output_set_fd(&sh->output, STDOUT_FILENO);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    execute_line(line);
+    printf("%-22s %8zu processes %10.0f processes/sec\n", "pids > file", pids.count,
+           pids.count / elapsed_seconds(&start));
+    unlink(target);
+
+    process_list_free(&list);
+    free(processes);
+    free(pids.pids);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "spawner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) + (double) (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void run_fork(char** argv) {
+    pid_t pid = fork();
+    if(pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+
+    if(pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    waitpid(pid, NULL, 0);
+}
+
+static void run_spawn(char** argv) {
+    pid_t pid = spawn_process(argv[0], argv, -1, -1);
+    if(pid == -1) {
+        perror("spawn");
+        exit(1);
+    }
+
+    waitpid(pid, NULL, 0);
+}
+
+static void measure(char* label, void (* run)(char**), char** argv, int iterations) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < iterations; ++i)
+        run(argv);
+
+    double seconds = elapsed_seconds(&start);
+    printf("%-12s %8d commands %10.0f commands/sec\n", label, iterations, iterations / seconds);
+}
+
+// Usage: spawn_bench [iterations] [resident MB]
+// The resident set is touched up front, since fork() cost grows with the size of the parent.
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    size_t resident_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    char* ballast = malloc(resident_mb << 20);
+    if(ballast != NULL)
+        memset(ballast, 1, resident_mb << 20);
+
+    char* command[] = {"/bin/true", NULL};
+    printf("resident set: %zu MB\n", resident_mb);
+    measure("fork+exec", run_fork, command, iterations);
+    measure("posix_spawn", run_spawn, command, iterations);
+    free(ballast);
+    return 0;
+}
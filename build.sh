@@ -1,3 +1,8 @@
 #!/bin/bash
 
-gcc -o my_shell main.c shell.c utility.c -I.
+# The Makefile is the build; this stays for the old entry point. `./build.sh bench` also builds the benchmarks.
+make my_shell || exit 1
+
+if [ "$1" == "bench" ]; then
+    make benches
+fi
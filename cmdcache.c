@@ -0,0 +1,140 @@
+#include "cmdcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void command_cache_init(CommandCache* cache, int capacity) {
+    table_init(&cache->lines);
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->count = 0;
+    cache->capacity = capacity;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void command_cache_free(CommandCache* cache) {
+    command_cache_clear(cache);
+    table_free(&cache->lines);
+}
+
+static void unlink_command(CommandCache* cache, CachedCommand* command) {
+    if(command->newer != NULL)
+        command->newer->older = command->older;
+    else
+        cache->newest = command->older;
+
+    if(command->older != NULL)
+        command->older->newer = command->newer;
+    else
+        cache->oldest = command->newer;
+}
+
+static void push_command(CommandCache* cache, CachedCommand* command) {
+    command->newer = NULL;
+    command->older = cache->newest;
+    if(cache->newest != NULL)
+        cache->newest->newer = command;
+    else
+        cache->oldest = command;
+
+    cache->newest = command;
+}
+
+static void remove_command(CommandCache* cache, CachedCommand* command) {
+    unlink_command(cache, command);
+    table_remove(&cache->lines, table_find(&cache->lines, command->line, command->line_length));
+    free(command);
+    --cache->count;
+}
+
+void command_cache_clear(CommandCache* cache) {
+    for(CachedCommand* command = cache->newest; command != NULL;) {
+        CachedCommand* older = command->older;
+        free(command);
+        command = older;
+    }
+
+    table_clear(&cache->lines);
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->count = 0;
+}
+
+void command_cache_forget_variable(CommandCache* cache, const char* name, size_t length) {
+    uint64_t bit = variable_bit(name, length);
+    for(CachedCommand* command = cache->newest; command != NULL;) {
+        CachedCommand* older = command->older;
+        if(command->variables & bit)
+            remove_command(cache, command);
+
+        command = older;
+    }
+}
+
+CachedCommand* command_cache_find(CommandCache* cache, const char* line, size_t length) {
+    TableEntry* entry = table_find(&cache->lines, line, length);
+    if(entry == NULL) {
+        ++cache->misses;
+        return NULL;
+    }
+
+    CachedCommand* command = entry->value;
+    unlink_command(cache, command);
+    push_command(cache, command);
+    ++cache->hits;
+    return command;
+}
+
+// The line, the token text and the token offsets and kinds share a single allocation, so the command is
+// released with a plain free().
+CachedCommand* command_create(const char* line, size_t length, char** tokens, const unsigned char* kinds,
+                              int token_count, FunctionPointer function, uint64_t variables) {
+    size_t text_length = 0;
+    for(int t = 0; t < token_count; ++t)
+        text_length += strlen(tokens[t]) + 1;
+
+    CachedCommand* command = malloc(sizeof(CachedCommand) + token_count * sizeof(uint32_t) + token_count + length +
+                                    1 + text_length);
+    command->offsets = (uint32_t*) (command + 1);
+    command->kinds = (unsigned char*) (command->offsets + token_count);
+    command->line = (char*) (command->kinds + token_count);
+    command->text = command->line + length + 1;
+    command->line_length = length;
+    command->text_length = text_length;
+    command->token_count = token_count;
+    command->function = function;
+    command->variables = variables;
+    memcpy(command->line, line, length);
+    command->line[length] = '\0';
+    memcpy(command->kinds, kinds, token_count);
+
+    size_t offset = 0;
+    for(int t = 0; t < token_count; ++t) {
+        size_t token_length = strlen(tokens[t]) + 1;
+        memcpy(command->text + offset, tokens[t], token_length);
+        command->offsets[t] = offset;
+        offset += token_length;
+    }
+
+    return command;
+}
+
+void command_cache_store(CommandCache* cache, const char* line, size_t length, char** tokens,
+                         const unsigned char* kinds, int token_count, FunctionPointer function, uint64_t variables) {
+    if(cache->capacity == 0)
+        return;
+
+    CachedCommand* command = command_create(line, length, tokens, kinds, token_count, function, variables);
+    TableEntry* entry = table_insert(&cache->lines, line, length);
+    if(entry->value != NULL) {
+        unlink_command(cache, entry->value);
+        free(entry->value);
+        --cache->count;
+    }
+
+    entry->value = command;
+    push_command(cache, command);
+    if(++cache->count > cache->capacity)
+        remove_command(cache, cache->oldest);
+}
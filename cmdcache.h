@@ -0,0 +1,26 @@
+#ifndef MYSHELL_CMDCACHE_H
+#define MYSHELL_CMDCACHE_H
+
+#include "typedefs.h"
+#include "table.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lines remember the variables they reference only as a set of bits, so changing a variable may also drop
+// a few lines that never used it, but never keeps one that did.
+static inline uint64_t variable_bit(const char* name, size_t length) {
+    return (uint64_t) 1 << (hash_bytes(name, length, 0) & 63);
+}
+
+CachedCommand* command_create(const char* line, size_t length, char** tokens, const unsigned char* kinds,
+                              int token_count, FunctionPointer function, uint64_t variables);
+void command_cache_init(CommandCache* cache, int capacity);
+void command_cache_free(CommandCache* cache);
+void command_cache_clear(CommandCache* cache);
+void command_cache_forget_variable(CommandCache* cache, const char* name, size_t length);
+CachedCommand* command_cache_find(CommandCache* cache, const char* line, size_t length);
+void command_cache_store(CommandCache* cache, const char* line, size_t length, char** tokens,
+                         const unsigned char* kinds, int token_count, FunctionPointer function, uint64_t variables);
+
+#endif //MYSHELL_CMDCACHE_H
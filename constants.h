@@ -2,20 +2,44 @@
 #define MYSHELL_CONSTANTS_H
 
 #define BUFFER_SIZE 512
-#define MAX_TOKENS 64
-#define NUM_COMMANDS 50
+#define SCRIPT_READ_BLOCK_SIZE 65536
+#define COPY_CHUNK_SIZE (1 << 30)
+#define COPY_BUFFER_MIN_SIZE 65536
+#define COPY_BUFFER_MAX_SIZE (1 << 20)
+#define MULTICOPY_QUEUE_DEPTH 32
+#define MULTICOPY_CHUNK_SIZE (128 << 10)
+#define MULTICOPY_THREADS 8
+#define INITIAL_TOKEN_CAPACITY 64
 #define PROMPT_TEXT_MAX_LENGTH 8
-#define PATH_MAX_LENGTH 128
 #define DIRECTORY_MAX_LENGTH 1024
 #define DEFAULT_PROMPT_TEXT "mysh"
 #define DEFAULT_PROCFS_PATH "/proc"
-#define MAX_LINE_LENGTH 1024
-#define MAX_PROCESSES_COUNT 4096
-#define HISTORY_SIZE 32
-#define MAX_ALIASES 32
-#define MAX_VARIABLES 32
-#define MAX_VARNAME_LENGTH 32
+#define PROCESS_NAME_MAX_LENGTH 64
+#define PROC_STAT_BUFFER_SIZE 4096
+#define PROC_SCAN_PIDS_PER_THREAD 2048
+#define PROC_SCAN_MAX_THREADS 16
+#define PID_LIST_INITIAL_CAPACITY 1024
+#define PROC_SNAPSHOT_RESERVED_FDS 64
+#define PTOP_DEFAULT_INTERVAL 1.0
+#define DEFAULT_HISTORY_SIZE 1000
+#define HISTORY_BYTES_PER_ENTRY 128
+#define HISTORY_FILE_NAME ".mysh_history"
+#define HISTORY_INDEX_INITIAL_CAPACITY 1024
+#define HISTORY_SEARCH_TRIGRAMS 16
+#define HISTORY_SEARCH_LIMIT 50
 #define NUM_COLORS 6
+#define TABLE_INITIAL_CAPACITY 16
+#define ARENA_BLOCK_SIZE 4096
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define PATH_CACHE_CHECK_INTERVAL_MS 1000
+#define COMMAND_CACHE_SIZE 64
+#define DEBUG_LEVEL_USAGE 2
+#define STATS_BUCKETS 64
+#define JOB_TABLE_INITIAL_CAPACITY 16
+#define JOB_EVENTS_BATCH 64
+#define JOB_UNWATCHED_POLL_MS 10
+#define OUTPUT_BUFFER_SIZE (64 << 10)
+#define OUTPUT_DIRECT_MIN 4096
 #define COLOR_RED     "\033[1;31m"
 #define COLOR_GREEN   "\033[1;32m"
 #define COLOR_YELLOW  "\033[1;33m"
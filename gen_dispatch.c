@@ -0,0 +1,73 @@
+#include "table.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_DISPATCH_BITS 12
+#define MAX_SEED_ATTEMPTS 1000000u
+
+static const char* names[] = {
+#define BUILTIN(name, function, help_text) name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+static const int name_count = sizeof(names) / sizeof(names[0]);
+
+static int try_seed(uint32_t seed, unsigned mask, unsigned char* slots) {
+    memset(slots, 0, mask + 1);
+    for(int n = 0; n < name_count; ++n) {
+        unsigned slot = hash_bytes(names[n], strlen(names[n]), seed) & mask;
+        if(slots[slot] != 0)
+            return 0;
+
+        slots[slot] = n + 1;
+    }
+
+    return 1;
+}
+
+// Searches for a seed under which every builtin name hashes to its own slot, so find_builtin() needs
+// a single hash and at most one strcmp for both hits and misses.
+int main(int argc, char** argv) {
+    static unsigned char slots[1 << MAX_DISPATCH_BITS];
+    if(name_count > 254) {
+        fprintf(stderr, "gen_dispatch: too many builtins\n");
+        return 1;
+    }
+
+    int bits = 1;
+    while((1 << bits) < name_count * 2)
+        ++bits;
+
+    for(; bits <= MAX_DISPATCH_BITS; ++bits) {
+        unsigned mask = (1u << bits) - 1;
+        for(uint32_t seed = 0; seed < MAX_SEED_ATTEMPTS; ++seed) {
+            if(!try_seed(seed, mask, slots))
+                continue;
+
+            FILE* output = argc > 1 ? fopen(argv[1], "w") : stdout;
+            if(output == NULL) {
+                perror("gen_dispatch");
+                return 1;
+            }
+
+            fprintf(output, "// Generated by gen_dispatch from builtins.def, do not edit.\n");
+            fprintf(output, "#ifndef MYSHELL_DISPATCH_H\n#define MYSHELL_DISPATCH_H\n\n");
+            fprintf(output, "#define DISPATCH_SEED %uu\n", seed);
+            fprintf(output, "#define DISPATCH_MASK %uu\n\n", mask);
+            fprintf(output, "static const unsigned char dispatch_slots[%u] = {", mask + 1);
+            for(unsigned s = 0; s <= mask; ++s)
+                fprintf(output, "%s%3d,", s % 16 == 0 ? "\n        " : " ", slots[s]);
+
+            fprintf(output, "\n};\n\n#endif //MYSHELL_DISPATCH_H\n");
+            if(output != stdout)
+                fclose(output);
+
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "gen_dispatch: no perfect hash found\n");
+    return 1;
+}
@@ -0,0 +1,96 @@
+#include "histindex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t slot_of(uint32_t trigram, size_t capacity) {
+    return (trigram * 2654435761u) & (capacity - 1);
+}
+
+static Postings* probe(Postings* slots, size_t capacity, uint32_t trigram) {
+    size_t slot = slot_of(trigram, capacity);
+    while(slots[slot].trigram != 0 && slots[slot].trigram != trigram)
+        slot = (slot + 1) & (capacity - 1);
+
+    return &slots[slot];
+}
+
+static void grow(HistoryIndex* index) {
+    size_t capacity = index->capacity * 2;
+    Postings* slots = calloc(capacity, sizeof(Postings));
+    for(size_t i = 0; i < index->capacity; ++i)
+        if(index->slots[i].trigram != 0)
+            *probe(slots, capacity, index->slots[i].trigram) = index->slots[i];
+
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+}
+
+void history_index_init(HistoryIndex* index) {
+    index->capacity = HISTORY_INDEX_INITIAL_CAPACITY;
+    index->count = 0;
+    index->slots = calloc(index->capacity, sizeof(Postings));
+}
+
+void history_index_free(HistoryIndex* index) {
+    for(size_t i = 0; i < index->capacity; ++i)
+        free(index->slots[i].serials);
+
+    free(index->slots);
+}
+
+// Serials are appended in increasing order, so every posting list stays sorted and a trigram that
+// occurs several times in one line is recorded once by comparing against the last serial.
+void history_index_add(HistoryIndex* index, const char* line, size_t length, uint32_t serial) {
+    for(size_t c = 0; c + 3 <= length; ++c) {
+        uint32_t trigram = make_trigram(line + c);
+        Postings* postings = probe(index->slots, index->capacity, trigram);
+        if(postings->trigram == 0) {
+            if((index->count + 1) * 2 > index->capacity) {
+                grow(index);
+                postings = probe(index->slots, index->capacity, trigram);
+            }
+
+            postings->trigram = trigram;
+            ++index->count;
+        }
+
+        if(postings->count > 0 && postings->serials[postings->count - 1] == serial)
+            continue;
+
+        if(postings->count == postings->capacity) {
+            postings->capacity = postings->capacity == 0 ? 4 : postings->capacity * 2;
+            postings->serials = realloc(postings->serials, postings->capacity * sizeof(uint32_t));
+        }
+
+        postings->serials[postings->count++] = serial;
+    }
+}
+
+// Drops the serials of entries that were evicted from the history ring.
+void history_index_prune(HistoryIndex* index, uint32_t oldest) {
+    for(size_t i = 0; i < index->capacity; ++i) {
+        Postings* postings = &index->slots[i];
+        size_t low = 0;
+        size_t high = postings->count;
+        while(low < high) {
+            size_t middle = (low + high) / 2;
+            if(postings->serials[middle] < oldest)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        if(low == 0)
+            continue;
+
+        postings->count -= low;
+        memmove(postings->serials, postings->serials + low, postings->count * sizeof(uint32_t));
+    }
+}
+
+Postings* history_index_find(HistoryIndex* index, uint32_t trigram) {
+    Postings* postings = probe(index->slots, index->capacity, trigram);
+    return postings->trigram == 0 ? NULL : postings;
+}
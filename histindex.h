@@ -0,0 +1,16 @@
+#ifndef MYSHELL_HISTINDEX_H
+#define MYSHELL_HISTINDEX_H
+
+#include "typedefs.h"
+
+void history_index_init(HistoryIndex* index);
+void history_index_free(HistoryIndex* index);
+void history_index_add(HistoryIndex* index, const char* line, size_t length, uint32_t serial);
+void history_index_prune(HistoryIndex* index, uint32_t oldest);
+Postings* history_index_find(HistoryIndex* index, uint32_t trigram);
+
+static inline uint32_t make_trigram(const char* str) {
+    return (uint32_t) (unsigned char) str[0] << 16 | (uint32_t) (unsigned char) str[1] << 8 | (unsigned char) str[2];
+}
+
+#endif //MYSHELL_HISTINDEX_H
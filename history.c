@@ -0,0 +1,237 @@
+#include "history.h"
+#include "histindex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static void evict_oldest(History* history) {
+    history->first = (history->first + 1) % history->capacity;
+    --history->count;
+}
+
+// Lines are stored back to back in a circular byte arena. A line that does not fit before the end of
+// the arena starts over at offset zero, and the oldest entries are evicted until the new line no longer
+// overlaps any of them.
+static void store(History* history, const char* line, size_t length) {
+    if(length + 1 > history->arena_size)
+        return;
+
+    if(history->count == history->capacity)
+        evict_oldest(history);
+
+    size_t offset = history->arena_head;
+    if(offset + length + 1 > history->arena_size) {
+        while(history->count > 0 && history->entries[history->first].offset >= offset)
+            evict_oldest(history);
+
+        offset = 0;
+    }
+
+    while(history->count > 0) {
+        HistoryEntry* oldest = &history->entries[history->first];
+        if(oldest->offset >= offset + length + 1 || oldest->offset + oldest->length + 1 <= offset)
+            break;
+
+        evict_oldest(history);
+    }
+
+    memcpy(history->arena + offset, line, length);
+    history->arena[offset + length] = '\0';
+    HistoryEntry* entry = &history->entries[(history->first + history->count) % history->capacity];
+    entry->offset = offset;
+    entry->length = length;
+    ++history->count;
+    history->arena_head = offset + length + 1;
+    history_index_add(&history->index, line, length, history->total++);
+    if(history->total % history->capacity == 0)
+        history_index_prune(&history->index, history->total - history->count);
+}
+
+static char* file_path() {
+    char* path = getenv("MYSH_HISTFILE");
+    if(path != NULL)
+        return *path == '\0' ? NULL : strdup(path);
+
+    char* home = getenv("HOME");
+    if(home == NULL)
+        return NULL;
+
+    char* home_path = malloc(strlen(home) + strlen(HISTORY_FILE_NAME) + 2);
+    sprintf(home_path, "%s/%s", home, HISTORY_FILE_NAME);
+    return home_path;
+}
+
+// Only the tail of the file that fits into the ring is parsed, scanning backwards from the end of the
+// mapping, so startup does not depend on how large the file has grown.
+static void load(History* history, int fd) {
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == -1 || file_stat.st_size == 0)
+        return;
+
+    size_t size = file_stat.st_size;
+    char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) {
+        perror("history");
+        return;
+    }
+
+    char* end = data + size;
+    char* floor = size > history->arena_size ? end - history->arena_size : data;
+    char* first = end;
+    char* cursor = end[-1] == '\n' ? end - 1 : end;
+    for(size_t lines = 0; lines < history->capacity && cursor > floor; ++lines) {
+        char* line = cursor;
+        while(line > floor && line[-1] != '\n')
+            --line;
+
+        if(line == floor && floor != data && floor[-1] != '\n')
+            break;
+
+        first = line;
+        if(line == data)
+            break;
+
+        cursor = line - 1;
+    }
+
+    for(char* line = first; line < end;) {
+        char* newline = memchr(line, '\n', end - line);
+        if(newline == NULL)
+            newline = end;
+
+        if(newline > line)
+            store(history, line, newline - line);
+
+        line = newline + 1;
+    }
+
+    munmap(data, size);
+}
+
+void history_init(History* history, size_t capacity) {
+    history->capacity = capacity;
+    history->entries = malloc(capacity * sizeof(HistoryEntry));
+    history->arena_size = capacity * HISTORY_BYTES_PER_ENTRY;
+    history->arena = malloc(history->arena_size);
+    history->arena_head = 0;
+    history->first = 0;
+    history->count = 0;
+    history->total = 0;
+    history_index_init(&history->index);
+    history->fd = -1;
+}
+
+void history_free(History* history) {
+    if(history->fd != -1)
+        close(history->fd);
+
+    history_index_free(&history->index);
+    free(history->entries);
+    free(history->arena);
+}
+
+void history_open(History* history) {
+    char* path = file_path();
+    if(path == NULL)
+        return;
+
+    history->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if(history->fd == -1) {
+        perror("history");
+        return;
+    }
+
+    load(history, history->fd);
+}
+
+// Each line goes out in a single O_APPEND write, so concurrent shells never interleave partial lines.
+void history_append(History* history, const char* line) {
+    size_t length = strlen(line);
+    store(history, line, length);
+    if(history->fd == -1)
+        return;
+
+    struct iovec segments[2] = {{(void*) line, length}, {"\n", 1}};
+    if(writev(history->fd, segments, 2) == -1) {
+        perror("history");
+        close(history->fd);
+        history->fd = -1;
+    }
+}
+
+char* history_get(History* history, size_t index) {
+    return history->arena + history->entries[(history->first + index) % history->capacity].offset;
+}
+
+static _Bool matches(const char* line, const char* pattern, size_t length, _Bool prefix) {
+    return prefix ? strncmp(line, pattern, length) == 0 : strstr(line, pattern) != NULL;
+}
+
+static _Bool contains(Postings* postings, uint32_t serial) {
+    size_t low = 0;
+    size_t high = postings->count;
+    while(low < high) {
+        size_t middle = (low + high) / 2;
+        if(postings->serials[middle] < serial)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low < postings->count && postings->serials[low] == serial;
+}
+
+// Candidates are taken newest first from the shortest posting list among the pattern's trigrams and
+// checked against the others, then confirmed on the line itself. Patterns shorter than a trigram are
+// matched by scanning the ring.
+size_t history_search(History* history, const char* pattern, _Bool prefix, size_t* results, size_t max_results) {
+    size_t length = strlen(pattern);
+    size_t found = 0;
+    if(length < 3) {
+        for(size_t i = history->count; i-- > 0 && found < max_results;)
+            if(matches(history_get(history, i), pattern, length, prefix))
+                results[found++] = i;
+
+        return found;
+    }
+
+    Postings* lists[HISTORY_SEARCH_TRIGRAMS];
+    size_t list_count = length - 2 < HISTORY_SEARCH_TRIGRAMS ? length - 2 : HISTORY_SEARCH_TRIGRAMS;
+    for(size_t l = 0; l < list_count; ++l) {
+        size_t c = l * (length - 3) / (list_count > 1 ? list_count - 1 : 1);
+        Postings* postings = history_index_find(&history->index, make_trigram(pattern + c));
+        if(postings == NULL || postings->count == 0)
+            return 0;
+
+        size_t position = l;
+        while(position > 0 && lists[position - 1]->count > postings->count) {
+            lists[position] = lists[position - 1];
+            --position;
+        }
+
+        lists[position] = postings;
+    }
+
+    uint32_t oldest = history->total - history->count;
+    for(size_t p = lists[0]->count; p-- > 0 && found < max_results;) {
+        uint32_t serial = lists[0]->serials[p];
+        if(serial < oldest)
+            break;
+
+        _Bool candidate = 1;
+        for(size_t l = 1; l < list_count && candidate; ++l)
+            candidate = contains(lists[l], serial);
+
+        if(candidate && matches(history_get(history, serial - oldest), pattern, length, prefix))
+            results[found++] = serial - oldest;
+    }
+
+    return found;
+}
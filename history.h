@@ -0,0 +1,13 @@
+#ifndef MYSHELL_HISTORY_H
+#define MYSHELL_HISTORY_H
+
+#include "typedefs.h"
+
+void history_init(History* history, size_t capacity);
+void history_free(History* history);
+void history_open(History* history);
+void history_append(History* history, const char* line);
+char* history_get(History* history, size_t index);
+size_t history_search(History* history, const char* pattern, _Bool prefix, size_t* results, size_t max_results);
+
+#endif //MYSHELL_HISTORY_H
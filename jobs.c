@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+// Every background process is watched through a pidfd registered with one epoll instance, so a completion is
+// found and reaped on its own with waitid(P_PIDFD) instead of by a waitpid(WAIT_ANY) sweep, which cannot tell
+// whose status it collected. Processes the kernel gives no pidfd for are waited for by PID instead.
+
+void job_table_init(JobTable* table) {
+    table->capacity = JOB_TABLE_INITIAL_CAPACITY;
+    table->slots = calloc(table->capacity, sizeof(Job*));
+    table->count = 0;
+    table->running = 0;
+    table->unwatched = 0;
+    table->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    table->last_status = 0;
+    table->limit_raised = 0;
+}
+
+// Closing a pidfd only drops its epoll registration once no forked child holds a copy of it any more, so it
+// is removed explicitly, or a stale event could point at a freed process.
+static void close_pidfd(JobTable* table, JobProcess* process) {
+    epoll_ctl(table->epoll_fd, EPOLL_CTL_DEL, process->pidfd, NULL);
+    close(process->pidfd);
+    process->pidfd = -1;
+}
+
+static void free_job(JobTable* table, Job* job) {
+    for(int p = 0; p < job->process_count; ++p)
+        if(job->processes[p].pidfd != -1)
+            close_pidfd(table, &job->processes[p]);
+
+    free(job->command);
+    free(job->processes);
+    free(job);
+}
+
+// Jobs still running are left to finish on their own.
+void job_table_free(JobTable* table) {
+    for(int s = 0; s < table->count; ++s)
+        if(table->slots[s] != NULL)
+            free_job(table, table->slots[s]);
+
+    free(table->slots);
+    if(table->epoll_fd != -1)
+        close(table->epoll_fd);
+}
+
+// Thousands of background jobs need more descriptors than the usual soft limit of 1024, so the first time
+// pidfd_open() runs out the soft limit is raised to the hard one.
+static int open_pidfd(JobTable* table, int pid) {
+    if(table->epoll_fd == -1)
+        return -1;
+
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if(pidfd == -1 && errno == EMFILE && !table->limit_raised) {
+        table->limit_raised = 1;
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            pidfd = syscall(SYS_pidfd_open, pid, 0);
+        }
+    }
+
+    return pidfd;
+}
+
+// Job numbers are one more than the highest in use, so they only get reused once the newest jobs are gone.
+Job* job_start(JobTable* table, const char* command, const int* pids, int count) {
+    if(table->count == table->capacity) {
+        table->capacity *= 2;
+        table->slots = realloc(table->slots, table->capacity * sizeof(Job*));
+    }
+
+    Job* job = malloc(sizeof(Job));
+    job->id = table->count + 1;
+    job->command = strdup(command);
+    job->processes = malloc(count * sizeof(JobProcess));
+    job->process_count = count;
+    job->running = count;
+    job->status = 0;
+    for(int p = 0; p < count; ++p) {
+        JobProcess* process = &job->processes[p];
+        process->job = job;
+        process->pid = pids[p];
+        process->done = 0;
+        process->pidfd = open_pidfd(table, pids[p]);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = process};
+        if(process->pidfd != -1 && epoll_ctl(table->epoll_fd, EPOLL_CTL_ADD, process->pidfd, &event) == -1) {
+            close(process->pidfd);
+            process->pidfd = -1;
+        }
+
+        if(process->pidfd == -1)
+            ++table->unwatched;
+    }
+
+    table->slots[table->count++] = job;
+    ++table->running;
+    return job;
+}
+
+Job* job_find(JobTable* table, int id) {
+    return id >= 1 && id <= table->count ? table->slots[id - 1] : NULL;
+}
+
+JobProcess* job_find_process(JobTable* table, int pid) {
+    for(int s = 0; s < table->count; ++s) {
+        Job* job = table->slots[s];
+        for(int p = 0; job != NULL && p < job->process_count; ++p)
+            if(job->processes[p].pid == pid)
+                return &job->processes[p];
+    }
+
+    return NULL;
+}
+
+void job_remove(JobTable* table, Job* job) {
+    if(job->running > 0)
+        --table->running;
+
+    for(int p = 0; p < job->process_count; ++p)
+        if(!job->processes[p].done && job->processes[p].pidfd == -1)
+            --table->unwatched;
+
+    table->slots[job->id - 1] = NULL;
+    while(table->count > 0 && table->slots[table->count - 1] == NULL)
+        --table->count;
+
+    free_job(table, job);
+}
+
+static int decode_status(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// The status of a job is that of its last process, as for a foreground pipeline.
+static void finish_process(JobTable* table, JobProcess* process, int status) {
+    Job* job = process->job;
+    process->done = 1;
+    process->status = status;
+    if(process->pidfd != -1)
+        close_pidfd(table, process);
+    else
+        --table->unwatched;
+
+    if(process == &job->processes[job->process_count - 1])
+        job->status = status;
+
+    if(--job->running == 0)
+        --table->running;
+
+    table->last_status = status;
+}
+
+// A process that cannot be waited for at all, because something else reaped it, is finished with the error.
+static int reap_pidfd(JobTable* table, JobProcess* process, int options) {
+    siginfo_t info;
+    info.si_pid = 0;
+    while(waitid(P_PIDFD, process->pidfd, &info, WEXITED | options) == -1) {
+        if(errno != EINTR) {
+            finish_process(table, process, errno);
+            return 1;
+        }
+    }
+
+    if(info.si_pid == 0)
+        return 0;
+
+    finish_process(table, process, info.si_code == CLD_EXITED ? info.si_status : 1);
+    return 1;
+}
+
+// Processes without a pidfd can only be found by asking for each of them in turn. One that is no child any
+// more was reaped elsewhere and can never be waited for, so it is finished with ECHILD.
+static int reap_unwatched(JobTable* table) {
+    int reaped = 0;
+    for(int s = 0; s < table->count && table->unwatched > 0; ++s) {
+        Job* job = table->slots[s];
+        for(int p = 0; job != NULL && p < job->process_count; ++p) {
+            JobProcess* process = &job->processes[p];
+            int status;
+            if(process->done || process->pidfd != -1)
+                continue;
+
+            int pid = waitpid(process->pid, &status, WNOHANG);
+            if(pid > 0 || (pid == -1 && errno == ECHILD)) {
+                finish_process(table, process, pid > 0 ? decode_status(status) : ECHILD);
+                ++reaped;
+            }
+        }
+    }
+
+    return reaped;
+}
+
+// Reaps whatever has finished and returns how many processes that was. A negative timeout blocks until at
+// least one process of a running job finishes.
+int job_table_poll(JobTable* table, int timeout) {
+    struct epoll_event events[JOB_EVENTS_BATCH];
+    int reaped = 0;
+    for(;;) {
+        // Epoll cannot see the unwatched processes, and waiting for any child could reap one that belongs to
+        // someone else, so a blocking poll wakes up now and then to ask for each of them by PID.
+        int watched = table->unwatched == 0 ? timeout : timeout < 0 ? JOB_UNWATCHED_POLL_MS : 0;
+        int count;
+        if(table->epoll_fd != -1)
+            count = epoll_wait(table->epoll_fd, events, JOB_EVENTS_BATCH, watched);
+        else
+            count = table->unwatched > 0 ? poll(NULL, 0, watched) : 0;
+
+        if(count == -1 && errno == EINTR)
+            continue;
+
+        if(count == -1)
+            return reaped;
+
+        for(int e = 0; e < count; ++e)
+            reaped += reap_pidfd(table, events[e].data.ptr, WNOHANG);
+
+        if(table->unwatched > 0)
+            reaped += reap_unwatched(table);
+
+        if(reaped > 0 || timeout >= 0 || table->running == 0)
+            return reaped;
+    }
+}
+
+int job_wait_process(JobTable* table, JobProcess* process) {
+    if(process->done)
+        return process->status;
+
+    if(process->pidfd != -1) {
+        reap_pidfd(table, process, 0);
+        return process->status;
+    }
+
+    int status;
+    while(waitpid(process->pid, &status, 0) == -1) {
+        if(errno != EINTR) {
+            finish_process(table, process, errno);
+            return errno;
+        }
+    }
+
+    finish_process(table, process, decode_status(status));
+    return process->status;
+}
+
+int job_wait(JobTable* table, Job* job) {
+    for(int p = 0; p < job->process_count; ++p)
+        job_wait_process(table, &job->processes[p]);
+
+    return job->status;
+}
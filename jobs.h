@@ -0,0 +1,16 @@
+#ifndef MYSHELL_JOBS_H
+#define MYSHELL_JOBS_H
+
+#include "typedefs.h"
+
+void job_table_init(JobTable* table);
+void job_table_free(JobTable* table);
+Job* job_start(JobTable* table, const char* command, const int* pids, int count);
+Job* job_find(JobTable* table, int id);
+JobProcess* job_find_process(JobTable* table, int pid);
+void job_remove(JobTable* table, Job* job);
+int job_table_poll(JobTable* table, int timeout);
+int job_wait(JobTable* table, Job* job);
+int job_wait_process(JobTable* table, JobProcess* process);
+
+#endif //MYSHELL_JOBS_H
@@ -0,0 +1,300 @@
+#include "lexer.h"
+#include "shell.h"
+#include "table.h"
+#include "cmdcache.h"
+#include "stats.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    long start;
+    unsigned char kind;
+    _Bool quoted;
+    _Bool has_quotes;
+} Lexer;
+
+static const unsigned char special_unquoted[256] = {['\0'] = 1, [' '] = 1, ['\t'] = 1, ['"'] = 1, ['$'] = 1,
+                                                    ['|'] = 1};
+static const unsigned char special_quoted[256] = {['\0'] = 1, ['"'] = 1, ['$'] = 1};
+
+static size_t scan_plain_scalar(const char* str, _Bool quoted) {
+    const unsigned char* special = quoted ? special_quoted : special_unquoted;
+    const char* c = str;
+    while(!special[(unsigned char) *c])
+        ++c;
+
+    return c - str;
+}
+
+// The vector scanners only ever load aligned blocks, which never cross a page boundary, so reading past the
+// terminating NUL is safe even at the very end of a mapping. AddressSanitizer cannot know that, so it is told to
+// leave them alone.
+#ifdef __x86_64__
+__attribute__((no_sanitize_address))
+static size_t scan_plain_sse2(const char* str, _Bool quoted) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i dollar = _mm_set1_epi8('$');
+    const __m128i space = _mm_set1_epi8(quoted ? '\0' : ' ');
+    const __m128i tab = _mm_set1_epi8(quoted ? '\0' : '\t');
+    const __m128i bar = _mm_set1_epi8(quoted ? '\0' : '|');
+    const char* block = (const char*) ((uintptr_t) str & ~(uintptr_t) 15);
+    unsigned offset = str - block;
+    for(;; block += 16) {
+        __m128i chunk = _mm_load_si128((const __m128i*) block);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, zero), _mm_cmpeq_epi8(chunk, quote)),
+                                    _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, dollar),
+                                                              _mm_cmpeq_epi8(chunk, bar)),
+                                                 _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                                              _mm_cmpeq_epi8(chunk, tab))));
+        unsigned mask = (unsigned) _mm_movemask_epi8(hits) >> offset << offset;
+        if(mask != 0)
+            return block + __builtin_ctz(mask) - str;
+
+        offset = 0;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t scan_plain_avx2(const char* str, _Bool quoted) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i dollar = _mm256_set1_epi8('$');
+    const __m256i space = _mm256_set1_epi8(quoted ? '\0' : ' ');
+    const __m256i tab = _mm256_set1_epi8(quoted ? '\0' : '\t');
+    const __m256i bar = _mm256_set1_epi8(quoted ? '\0' : '|');
+    const char* block = (const char*) ((uintptr_t) str & ~(uintptr_t) 31);
+    unsigned offset = str - block;
+    for(;; block += 32) {
+        __m256i chunk = _mm256_load_si256((const __m256i*) block);
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, zero),
+                                                       _mm256_cmpeq_epi8(chunk, quote)),
+                                       _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, dollar),
+                                                                       _mm256_cmpeq_epi8(chunk, bar)),
+                                                       _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                                                                       _mm256_cmpeq_epi8(chunk, tab))));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(hits) >> offset << offset;
+        if(mask != 0)
+            return block + __builtin_ctz(mask) - str;
+
+        offset = 0;
+    }
+}
+#endif
+
+static size_t (* scan_plain)(const char* str, _Bool quoted) = scan_plain_scalar;
+
+// Returns the scanner actually selected, which is the best one at or below the requested level the CPU supports.
+int select_scanner(int level) {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if(level >= SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+        scan_plain = scan_plain_avx2;
+        return SCAN_AVX2;
+    }
+
+    if(level >= SCAN_SSE2) {
+        scan_plain = scan_plain_sse2;
+        return SCAN_SSE2;
+    }
+#endif
+    scan_plain = scan_plain_scalar;
+    return SCAN_SCALAR;
+}
+
+unsigned char classify_word(const char* word) {
+    if((word[0] == '<' || word[0] == '>') && word[1] != '\0')
+        return word[0] == '<' ? TOKEN_INPUT_REDIRECT : TOKEN_OUTPUT_REDIRECT;
+
+    if(word[0] == '&' && word[1] == '\0')
+        return TOKEN_BACKGROUND;
+
+    if(word[0] == '|' && word[1] == '\0')
+        return TOKEN_PIPE;
+
+    return TOKEN_WORD;
+}
+
+// Tokens are built directly in the line arena, which only ever grows, so once it has seen the longest line of
+// a session no further allocations are made.
+void reserve_line(size_t length) {
+    if(sh->line.used + length <= sh->line.size)
+        return;
+
+    uintptr_t old_data = (uintptr_t) sh->line.data;
+    while(sh->line.used + length > sh->line.size)
+        sh->line.size *= 2;
+
+    sh->line.data = realloc(sh->line.data, sh->line.size);
+    for(int t = 0; t < sh->token_count; ++t)
+        if((uintptr_t) sh->tokens[t] - old_data < sh->line.used)
+            sh->tokens[t] = sh->line.data + ((uintptr_t) sh->tokens[t] - old_data);
+}
+
+void append_line(const char* str, size_t length) {
+    reserve_line(length);
+    memcpy(sh->line.data + sh->line.used, str, length);
+    sh->line.used += length;
+}
+
+void reserve_tokens(size_t count) {
+    if(count + 1 <= sh->token_capacity)
+        return;
+
+    while(count + 1 > sh->token_capacity)
+        sh->token_capacity *= 2;
+
+    sh->tokens = realloc(sh->tokens, sh->token_capacity * sizeof(char*));
+    sh->token_kinds = realloc(sh->token_kinds, sh->token_capacity);
+}
+
+static inline void emit(const char* str, size_t length) {
+    if(sh->line.used + length > sh->line.size)
+        reserve_line(length);
+
+    memcpy(sh->line.data + sh->line.used, str, length);
+    sh->line.used += length;
+}
+
+// Most words are short, so a few bytes are checked inline before paying for a call into the vector scanner.
+static inline size_t scan_run(const char* str, _Bool quoted) {
+    const unsigned char* special = quoted ? special_quoted : special_unquoted;
+    for(size_t i = 0; i < 8; ++i)
+        if(special[(unsigned char) str[i]])
+            return i;
+
+    return 8 + scan_plain(str + 8, quoted);
+}
+
+static void begin_token(Lexer* lexer) {
+    lexer->start = sh->line.used;
+    lexer->kind = TOKEN_WORD;
+    lexer->has_quotes = 0;
+}
+
+// An unquoted expansion that produced nothing yields no token, but "" is an empty argument.
+static void end_token(Lexer* lexer) {
+    size_t length = sh->line.used - lexer->start;
+    if(length == 0 && !lexer->has_quotes) {
+        lexer->start = -1;
+        return;
+    }
+
+    emit("", 1);
+    char* token = sh->line.data + lexer->start;
+    if(length == 1 && (lexer->kind == TOKEN_INPUT_REDIRECT || lexer->kind == TOKEN_OUTPUT_REDIRECT))
+        lexer->kind = TOKEN_WORD;
+    else if(length == 1 && token[0] == '&' && !lexer->has_quotes)
+        lexer->kind = TOKEN_BACKGROUND;
+
+    if((size_t) sh->token_count + 2 > sh->token_capacity)
+        reserve_tokens(sh->token_count + 1);
+
+    sh->tokens[sh->token_count] = token;
+    sh->token_kinds[sh->token_count++] = lexer->kind;
+    lexer->start = -1;
+}
+
+// Unquoted values are split into words on blanks, quoted ones are copied as they are.
+static const char* expand_variable(Lexer* lexer, const char* src) {
+    const char* name = src + 1;
+    if(!isalpha((unsigned char) *name)) {
+        emit("$", 1);
+        return name;
+    }
+
+    const char* end = name;
+    while(isalnum((unsigned char) *end) || *end == '_')
+        ++end;
+
+    sh->line_variables |= variable_bit(name, end - name);
+
+    TableEntry* entry = table_find(&sh->variables, name, end - name);
+    if(entry == NULL)
+        return end;
+
+    const char* value = entry->value;
+    if(lexer->quoted) {
+        emit(value, strlen(value));
+        return end;
+    }
+
+    while(*value != '\0') {
+        size_t run = strcspn(value, " \t");
+        if(run > 0) {
+            if(lexer->start < 0)
+                begin_token(lexer);
+
+            emit(value, run);
+            value += run;
+        }
+
+        if(*value != '\0') {
+            if(lexer->start >= 0)
+                end_token(lexer);
+
+            ++value;
+        }
+    }
+
+    return end;
+}
+
+// Expansion, quoting, comments and the redirect, background and pipe operators are all handled in one pass over
+// the input, and ordinary characters are copied in runs found by the vector scanner.
+void tokenize(char* input) {
+    sh->line.used = 0;
+    sh->token_count = 0;
+    sh->line_variables = 0;
+    Lexer lexer = {.start = -1, .quoted = 0};
+    const char* src = input;
+    for(;;) {
+        if(lexer.start < 0) {
+            while(*src == ' ' || *src == '\t')
+                ++src;
+
+            if(*src == '\0' || *src == '#')
+                break;
+
+            begin_token(&lexer);
+            if(*src == '|') {
+                lexer.kind = TOKEN_PIPE;
+                emit(src++, 1);
+                end_token(&lexer);
+                continue;
+            }
+
+            if(*src == '<' || *src == '>') {
+                lexer.kind = *src == '<' ? TOKEN_INPUT_REDIRECT : TOKEN_OUTPUT_REDIRECT;
+                emit(src++, 1);
+            }
+        }
+
+        size_t run = scan_run(src, lexer.quoted);
+        emit(src, run);
+        src += run;
+        if(*src == '\0')
+            break;
+
+        if(*src == '"') {
+            lexer.quoted = !lexer.quoted;
+            lexer.has_quotes = 1;
+            ++src;
+        } else if(*src == '$') {
+            STATS_PROBE(STAT_EXPAND, src = expand_variable(&lexer, src));
+        } else if(*src == '|') {
+            end_token(&lexer);
+        } else {
+            end_token(&lexer);
+            ++src;
+        }
+    }
+
+    if(lexer.start >= 0)
+        end_token(&lexer);
+
+    reserve_tokens(sh->token_count);
+    sh->tokens[sh->token_count] = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef MYSHELL_LEXER_H
+#define MYSHELL_LEXER_H
+
+#include "typedefs.h"
+
+#include <stddef.h>
+
+enum {
+    TOKEN_WORD,
+    TOKEN_INPUT_REDIRECT,
+    TOKEN_OUTPUT_REDIRECT,
+    TOKEN_BACKGROUND,
+    TOKEN_PIPE,
+};
+
+enum {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+int select_scanner(int level);
+unsigned char classify_word(const char* word);
+void reserve_line(size_t length);
+void append_line(const char* str, size_t length);
+void reserve_tokens(size_t count);
+
+#endif //MYSHELL_LEXER_H
@@ -0,0 +1,434 @@
+#include "multicopy.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    unsigned queued;
+} Ring;
+
+enum {
+    SLOT_FREE,
+    SLOT_OPEN_SOURCE,
+    SLOT_OPEN_TARGET,
+    SLOT_READ,
+    SLOT_WRITE,
+    SLOT_CLOSE,
+};
+
+typedef struct {
+    int state;
+    int pending;
+    const char* source;
+    char target[PATH_MAX];
+    int source_fd;
+    int target_fd;
+    off_t offset;
+    size_t length;
+    size_t written;
+    char* buffer;
+} Slot;
+
+typedef struct {
+    char** sources;
+    int count;
+    const char* directory;
+    int next;
+    int error;
+} CopyJob;
+
+static void report(const char* path, int error) {
+    fprintf(stderr, "cpcat: %s: %s\n", path, strerror(error));
+}
+
+static void target_path(char* target, const char* directory, const char* source) {
+    const char* name = strrchr(source, '/');
+    snprintf(target, PATH_MAX, "%s/%s", directory, name == NULL ? source : name + 1);
+}
+
+// A source that is already in the directory is its own target, and opening the target would truncate it
+// before it is read.
+static _Bool is_own_target(int source_fd, const char* target) {
+    struct stat source_stat;
+    struct stat target_stat;
+    if(fstat(source_fd, &source_stat) == -1 || stat(target, &target_stat) == -1)
+        return 0;
+
+    if(source_stat.st_dev != target_stat.st_dev || source_stat.st_ino != target_stat.st_ino)
+        return 0;
+
+    fprintf(stderr, "cpcat: %s: is the source itself\n", target);
+    return 1;
+}
+
+// Kernels before 5.6 have io_uring but not the open, read, write and close requests.
+static _Bool ring_supports_copy(int fd) {
+    static const int opcodes[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE};
+    struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    _Bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for(int o = 0; supported && o < 4; ++o)
+        supported = opcodes[o] <= probe->last_op && (probe->ops[opcodes[o]].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    return supported;
+}
+
+static int ring_init(Ring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd == -1)
+        return -1;
+
+    if(!ring_supports_copy(ring->fd)) {
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->sq_ring;
+    if(ring->sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->entries = params.sq_entries;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    ring->queued = 0;
+    return 0;
+}
+
+static void ring_free(Ring* ring) {
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    if(ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Every slot has at most two requests in flight and the ring has room for two per slot, so it never fills.
+static struct io_uring_sqe* ring_queue(Ring* ring, int opcode, int slot) {
+    unsigned tail = *ring->sq_tail + ring->queued;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = slot;
+    ring->sq_array[index] = index;
+    ++ring->queued;
+    return sqe;
+}
+
+static int ring_submit_and_wait(Ring* ring) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+    unsigned submitted = ring->queued;
+    ring->queued = 0;
+    for(;;) {
+        int result = (int) syscall(__NR_io_uring_enter, ring->fd, submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(result >= 0 || errno != EINTR)
+            return result;
+
+        submitted = 0;
+    }
+}
+
+static void queue_open(Ring* ring, Slot* slot, int index, const char* path, int flags) {
+    struct io_uring_sqe* sqe = ring_queue(ring, IORING_OP_OPENAT, index);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t) path;
+    sqe->open_flags = flags | O_CLOEXEC;
+    sqe->len = 0666;
+    slot->pending = 1;
+}
+
+static void queue_read(Ring* ring, Slot* slot, int index) {
+    struct io_uring_sqe* sqe = ring_queue(ring, IORING_OP_READ, index);
+    sqe->fd = slot->source_fd;
+    sqe->addr = (uintptr_t) slot->buffer;
+    sqe->len = MULTICOPY_CHUNK_SIZE;
+    sqe->off = slot->offset;
+    slot->state = SLOT_READ;
+    slot->pending = 1;
+}
+
+static void queue_write(Ring* ring, Slot* slot, int index) {
+    struct io_uring_sqe* sqe = ring_queue(ring, IORING_OP_WRITE, index);
+    sqe->fd = slot->target_fd;
+    sqe->addr = (uintptr_t) (slot->buffer + slot->written);
+    sqe->len = slot->length - slot->written;
+    sqe->off = slot->offset + slot->written;
+    slot->state = SLOT_WRITE;
+    slot->pending = 1;
+}
+
+static void queue_close(Ring* ring, Slot* slot, int index) {
+    slot->state = SLOT_CLOSE;
+    slot->pending = 0;
+    if(slot->source_fd != -1) {
+        ring_queue(ring, IORING_OP_CLOSE, index)->fd = slot->source_fd;
+        ++slot->pending;
+    }
+
+    if(slot->target_fd != -1) {
+        ring_queue(ring, IORING_OP_CLOSE, index)->fd = slot->target_fd;
+        ++slot->pending;
+    }
+
+    if(slot->pending == 0)
+        slot->state = SLOT_FREE;
+}
+
+static void start_slot(Ring* ring, Slot* slot, int index, CopyJob* job) {
+    if(job->next == job->count) {
+        slot->state = SLOT_FREE;
+        return;
+    }
+
+    slot->source = job->sources[job->next++];
+    target_path(slot->target, job->directory, slot->source);
+    slot->source_fd = -1;
+    slot->target_fd = -1;
+    slot->offset = 0;
+    slot->state = SLOT_OPEN_SOURCE;
+    queue_open(ring, slot, index, slot->source, O_RDONLY);
+}
+
+// Each slot walks one file through open, open, read/write until end of file, and close; a finished slot
+// picks up the next file straight away.
+static void advance_slot(Ring* ring, Slot* slot, int index, int result, CopyJob* job) {
+    --slot->pending;
+    if(slot->state != SLOT_CLOSE && result < 0) {
+        report(slot->state == SLOT_OPEN_SOURCE || slot->state == SLOT_READ ? slot->source : slot->target, -result);
+        job->error = -result;
+        queue_close(ring, slot, index);
+    } else if(slot->state == SLOT_OPEN_SOURCE) {
+        slot->source_fd = result;
+        if(is_own_target(result, slot->target)) {
+            job->error = EINVAL;
+            queue_close(ring, slot, index);
+        } else {
+            slot->state = SLOT_OPEN_TARGET;
+            queue_open(ring, slot, index, slot->target, O_WRONLY | O_CREAT | O_TRUNC);
+        }
+    } else if(slot->state == SLOT_OPEN_TARGET) {
+        slot->target_fd = result;
+        queue_read(ring, slot, index);
+    } else if(slot->state == SLOT_READ && result == 0) {
+        queue_close(ring, slot, index);
+    } else if(slot->state == SLOT_READ) {
+        slot->length = result;
+        slot->written = 0;
+        queue_write(ring, slot, index);
+    } else if(slot->state == SLOT_WRITE) {
+        slot->written += result;
+        if(slot->written < slot->length) {
+            queue_write(ring, slot, index);
+        } else {
+            slot->offset += slot->length;
+            queue_read(ring, slot, index);
+        }
+    }
+
+    if(slot->state == SLOT_CLOSE && slot->pending == 0)
+        slot->state = SLOT_FREE;
+
+    if(slot->state == SLOT_FREE)
+        start_slot(ring, slot, index, job);
+}
+
+static void copy_with_threads(CopyJob* job);
+
+// A failed io_uring_enter() leaves the slots where they are. Once the ring is closed, which cancels what it still
+// had in flight, their descriptors are closed here and the threads copy the files that were not finished, from
+// the start.
+static void hand_over_to_threads(Slot* slots, int slot_count, CopyJob* job) {
+    char** rest = malloc((slot_count + job->count - job->next) * sizeof(char*));
+    int count = 0;
+    for(int s = 0; s < slot_count; ++s) {
+        if(slots[s].state == SLOT_FREE)
+            continue;
+
+        if(slots[s].source_fd != -1)
+            close(slots[s].source_fd);
+
+        if(slots[s].target_fd != -1)
+            close(slots[s].target_fd);
+
+        if(slots[s].state != SLOT_CLOSE)
+            rest[count++] = (char*) slots[s].source;
+    }
+
+    for(; job->next < job->count; ++job->next)
+        rest[count++] = job->sources[job->next];
+
+    CopyJob fallback = {rest, count, job->directory, 0, 0};
+    copy_with_threads(&fallback);
+    if(fallback.error != 0)
+        job->error = fallback.error;
+
+    free(rest);
+}
+
+static int copy_with_ring(CopyJob* job) {
+    Ring ring;
+    if(ring_init(&ring, MULTICOPY_QUEUE_DEPTH * 2) == -1)
+        return -1;
+
+    int slot_count = job->count < MULTICOPY_QUEUE_DEPTH ? job->count : MULTICOPY_QUEUE_DEPTH;
+    Slot* slots = calloc(slot_count, sizeof(Slot));
+    char* buffers = malloc((size_t) slot_count * MULTICOPY_CHUNK_SIZE);
+    for(int s = 0; s < slot_count; ++s) {
+        slots[s].buffer = buffers + (size_t) s * MULTICOPY_CHUNK_SIZE;
+        start_slot(&ring, &slots[s], s, job);
+    }
+
+    int active = slot_count;
+    _Bool failed = 0;
+    while(active > 0) {
+        if(ring_submit_and_wait(&ring) == -1) {
+            failed = 1;
+            break;
+        }
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head) {
+            struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            int s = (int) cqe->user_data;
+            advance_slot(&ring, &slots[s], s, cqe->res, job);
+            if(slots[s].state == SLOT_FREE)
+                --active;
+        }
+
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    ring_free(&ring);
+    if(failed)
+        hand_over_to_threads(slots, slot_count, job);
+
+    free(buffers);
+    free(slots);
+    return 0;
+}
+
+// Workers share the job, so the error is stored atomically, like the next index. errno is saved first, since
+// reporting may change it.
+static void copy_failed(CopyJob* job, const char* path, int error) {
+    if(path != NULL)
+        report(path, error);
+
+    __atomic_store_n(&job->error, error, __ATOMIC_RELAXED);
+}
+
+static void* copy_worker(void* argument) {
+    CopyJob* job = argument;
+    int index;
+    while((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        const char* source = job->sources[index];
+        char target[PATH_MAX];
+        target_path(target, job->directory, source);
+        int source_fd = open(source, O_RDONLY | O_CLOEXEC);
+        if(source_fd == -1) {
+            copy_failed(job, source, errno);
+            continue;
+        }
+
+        if(is_own_target(source_fd, target)) {
+            copy_failed(job, NULL, EINVAL);
+            close(source_fd);
+            continue;
+        }
+
+        int target_fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if(target_fd == -1) {
+            copy_failed(job, target, errno);
+        } else {
+            if(copy_data(source_fd, target_fd) == -1)
+                copy_failed(job, NULL, errno);
+
+            close(target_fd);
+        }
+
+        close(source_fd);
+    }
+
+    return NULL;
+}
+
+static void copy_with_threads(CopyJob* job) {
+    int thread_count = job->count < MULTICOPY_THREADS ? job->count : MULTICOPY_THREADS;
+    pthread_t threads[MULTICOPY_THREADS];
+    int started = 0;
+    for(; started < thread_count; ++started)
+        if(pthread_create(&threads[started], NULL, copy_worker, job) != 0)
+            break;
+
+    if(started == 0)
+        copy_worker(job);
+
+    for(int t = 0; t < started; ++t)
+        pthread_join(threads[t], NULL);
+}
+
+// Copies every source into the directory, keeping the base names. Returns 0, or the error of the last copy that
+// failed; every failure is reported as it happens.
+int copy_files(char** sources, int count, const char* directory) {
+    CopyJob job = {sources, count, directory, 0, 0};
+    if(copy_with_ring(&job) == -1)
+        copy_with_threads(&job);
+
+    return job.error;
+}
@@ -0,0 +1,8 @@
+#ifndef MYSHELL_MULTICOPY_H
+#define MYSHELL_MULTICOPY_H
+
+#include "typedefs.h"
+
+int copy_files(char** sources, int count, const char* directory);
+
+#endif //MYSHELL_MULTICOPY_H
@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+
+#include "output.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static const char digit_pairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+static unsigned char detect_kind(int fd) {
+    struct stat fd_stat;
+    if(fstat(fd, &fd_stat) == -1 || isatty(fd))
+        return OUTPUT_TERMINAL;
+
+    if(S_ISFIFO(fd_stat.st_mode) || S_ISSOCK(fd_stat.st_mode))
+        return OUTPUT_PIPE;
+
+    return OUTPUT_FILE;
+}
+
+void output_init(Output* output, int fd) {
+    output->size = OUTPUT_BUFFER_SIZE;
+    output->buffer = malloc(output->size);
+    output->used = 0;
+    output->fd = fd;
+    output->kind = detect_kind(fd);
+    output->owner = pthread_self();
+}
+
+void output_free(Output* output) {
+    output_flush(output);
+    free(output->buffer);
+}
+
+void output_set_fd(Output* output, int fd) {
+    output_flush(output);
+    output->fd = fd;
+    output->kind = detect_kind(fd);
+}
+
+// Whatever cannot be written is dropped. A reader that went away is not worth reporting.
+static void write_segments(Output* output, struct iovec* segments, int count) {
+    while(count > 0) {
+        ssize_t written = writev(output->fd, segments, count);
+        if(written == -1) {
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN) {
+                struct pollfd ready = {output->fd, POLLOUT, 0};
+                poll(&ready, 1, -1);
+                continue;
+            }
+
+            if(errno != EPIPE)
+                perror("write");
+
+            return;
+        }
+
+        for(; count > 0 && (size_t) written >= segments->iov_len; ++segments, --count)
+            written -= segments->iov_len;
+
+        if(count > 0) {
+            segments->iov_base = (char*) segments->iov_base + written;
+            segments->iov_len -= written;
+        }
+    }
+}
+
+void output_flush(Output* output) {
+    if(output->used == 0)
+        return;
+
+    struct iovec segment = {output->buffer, output->used};
+    write_segments(output, &segment, 1);
+    output->used = 0;
+}
+
+// Data that does not fit is written from where it is, behind what is already buffered, in a single writev().
+// Only pieces too small for that to pay off are copied, once the buffer has been emptied.
+void output_spill(Output* output, const char* data, size_t length) {
+    if(length < OUTPUT_DIRECT_MIN) {
+        output_flush(output);
+        memcpy(output->buffer, data, length);
+        output->used = length;
+        return;
+    }
+
+    struct iovec segments[2] = {{output->buffer, output->used}, {(void*) data, length}};
+    if(output->used > 0)
+        write_segments(output, segments, 2);
+    else
+        write_segments(output, &segments[1], 1);
+
+    output->used = 0;
+}
+
+// A terminal is written after every command. A pipe is written before the shell waits for more input, since
+// whoever reads it may be waiting for this output before sending any, and a file only when the buffer fills
+// or something else is about to write to the same descriptor.
+void output_command_done(Output* output, _Bool input_may_block) {
+    if(output->kind == OUTPUT_TERMINAL || (output->kind == OUTPUT_PIPE && input_may_block))
+        output_flush(output);
+}
+
+// Two digits are produced per division, right to left, and the result is padded on the left to the width.
+void output_long(Output* output, long value, int width) {
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    unsigned long magnitude = value < 0 ? -(unsigned long) value : (unsigned long) value;
+    while(magnitude >= 100) {
+        start -= 2;
+        memcpy(start, &digit_pairs[magnitude % 100 * 2], 2);
+        magnitude /= 100;
+    }
+
+    if(magnitude >= 10) {
+        start -= 2;
+        memcpy(start, &digit_pairs[magnitude * 2], 2);
+    } else {
+        *--start = (char) ('0' + magnitude);
+    }
+
+    if(value < 0)
+        *--start = '-';
+
+    if(end - start < width)
+        output_spaces(output, width - (int) (end - start));
+
+    output_write(output, start, end - start);
+}
+
+void output_spaces(Output* output, int count) {
+    static const char spaces[] = "                                ";
+    for(; count > (int) sizeof(spaces) - 1; count -= sizeof(spaces) - 1)
+        output_write(output, spaces, sizeof(spaces) - 1);
+
+    output_write(output, spaces, count);
+}
+
+// Everything printed with stdio goes through here unbuffered, so it stays in order with the direct writes.
+static ssize_t stream_write(void* cookie, const char* data, size_t length) {
+    output_write(cookie, data, length);
+    return (ssize_t) length;
+}
+
+static int stream_close(void* cookie) {
+    output_flush(cookie);
+    return 0;
+}
+
+FILE* output_open_stream(Output* output) {
+    cookie_io_functions_t functions = {NULL, stream_write, NULL, stream_close};
+    FILE* stream = fopencookie(output, "w", functions);
+    setvbuf(stream, NULL, _IONBF, 0);
+    return stream;
+}
+
+// Diagnostics are written after what was printed before them, even when both go to the same file. Only the thread
+// that owns the output flushes it, since relay and copy threads report errors while it may be writing.
+static ssize_t error_stream_write(void* cookie, const char* data, size_t length) {
+    Output* output = cookie;
+    if(pthread_equal(pthread_self(), output->owner))
+        output_flush(output);
+
+    for(size_t left = length; left > 0;) {
+        ssize_t written = write(STDERR_FILENO, data, left);
+        if(written == -1 && errno == EINTR)
+            continue;
+
+        if(written == -1)
+            break;
+
+        data += written;
+        left -= written;
+    }
+
+    return (ssize_t) length;
+}
+
+FILE* output_open_error_stream(Output* output) {
+    cookie_io_functions_t functions = {NULL, error_stream_write, NULL, NULL};
+    FILE* stream = fopencookie(output, "w", functions);
+    setvbuf(stream, NULL, _IONBF, 0);
+    return stream;
+}
@@ -0,0 +1,46 @@
+#ifndef MYSHELL_OUTPUT_H
+#define MYSHELL_OUTPUT_H
+
+#include "typedefs.h"
+
+#include <string.h>
+
+enum {
+    OUTPUT_TERMINAL,
+    OUTPUT_PIPE,
+    OUTPUT_FILE,
+};
+
+void output_init(Output* output, int fd);
+void output_free(Output* output);
+void output_set_fd(Output* output, int fd);
+FILE* output_open_stream(Output* output);
+FILE* output_open_error_stream(Output* output);
+void output_spill(Output* output, const char* data, size_t length);
+void output_flush(Output* output);
+void output_command_done(Output* output, _Bool input_may_block);
+void output_long(Output* output, long value, int width);
+void output_spaces(Output* output, int count);
+
+static inline void output_write(Output* output, const char* data, size_t length) {
+    if(output->used + length > output->size) {
+        output_spill(output, data, length);
+        return;
+    }
+
+    memcpy(output->buffer + output->used, data, length);
+    output->used += length;
+}
+
+static inline void output_string(Output* output, const char* str) {
+    output_write(output, str, strlen(str));
+}
+
+static inline void output_char(Output* output, char c) {
+    if(output->used == output->size)
+        output_flush(output);
+
+    output->buffer[output->used++] = c;
+}
+
+#endif //MYSHELL_OUTPUT_H
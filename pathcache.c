@@ -0,0 +1,155 @@
+#include "pathcache.h"
+#include "table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void free_entry(TableEntry* entry) {
+    PathEntry* path_entry = entry->value;
+    free(path_entry->path);
+    free(path_entry);
+}
+
+static void load_directories(PathCache* cache) {
+    for(int d = 0; d < cache->directory_count; ++d)
+        free(cache->directories[d].name);
+
+    free(cache->directories);
+    cache->directory_count = 1;
+    for(char* c = cache->path; *c != '\0'; ++c)
+        if(*c == ':')
+            ++cache->directory_count;
+
+    cache->directories = calloc(cache->directory_count, sizeof(PathDirectory));
+    char* start = cache->path;
+    for(int d = 0; d < cache->directory_count; ++d) {
+        char* end = strchr(start, ':');
+        if(end == NULL)
+            end = start + strlen(start);
+
+        cache->directories[d].name = end == start ? strdup(".") : strndup(start, end - start);
+        struct stat directory_stat;
+        if(stat(cache->directories[d].name, &directory_stat) == 0)
+            cache->directories[d].mtime = directory_stat.st_mtim;
+
+        start = end + 1;
+    }
+}
+
+static _Bool directories_changed(PathCache* cache) {
+    _Bool changed = 0;
+    for(int d = 0; d < cache->directory_count; ++d) {
+        struct stat directory_stat;
+        struct timespec mtime = {0, 0};
+        if(stat(cache->directories[d].name, &directory_stat) == 0)
+            mtime = directory_stat.st_mtim;
+
+        if(mtime.tv_sec != cache->directories[d].mtime.tv_sec || mtime.tv_nsec != cache->directories[d].mtime.tv_nsec) {
+            cache->directories[d].mtime = mtime;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+// PATH itself is compared on every lookup, the directory mtimes at most once per check interval.
+static void validate(PathCache* cache) {
+    char* path = getenv("PATH");
+    if(path == NULL)
+        path = DEFAULT_PATH;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if(cache->path == NULL || strcmp(cache->path, path) != 0) {
+        free(cache->path);
+        cache->path = strdup(path);
+        load_directories(cache);
+        path_cache_clear(cache);
+        cache->checked = now;
+        return;
+    }
+
+    long elapsed_ms = (now.tv_sec - cache->checked.tv_sec) * 1000 + (now.tv_nsec - cache->checked.tv_nsec) / 1000000;
+    if(elapsed_ms < PATH_CACHE_CHECK_INTERVAL_MS)
+        return;
+
+    cache->checked = now;
+    if(directories_changed(cache))
+        path_cache_clear(cache);
+}
+
+static char* resolve(PathCache* cache, char* command) {
+    char candidate[PATH_MAX];
+    for(int d = 0; d < cache->directory_count; ++d) {
+        if(snprintf(candidate, sizeof(candidate), "%s/%s", cache->directories[d].name, command) >= PATH_MAX)
+            continue;
+
+        struct stat file_stat;
+        if(stat(candidate, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && access(candidate, X_OK) == 0)
+            return strdup(candidate);
+    }
+
+    return NULL;
+}
+
+void path_cache_init(PathCache* cache) {
+    table_init(&cache->commands);
+    cache->path = NULL;
+    cache->directories = NULL;
+    cache->directory_count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void path_cache_free(PathCache* cache) {
+    path_cache_clear(cache);
+    table_free(&cache->commands);
+    for(int d = 0; d < cache->directory_count; ++d)
+        free(cache->directories[d].name);
+
+    free(cache->directories);
+    free(cache->path);
+}
+
+void path_cache_clear(PathCache* cache) {
+    for(size_t i = 0; i < cache->commands.capacity; ++i)
+        if(cache->commands.entries[i].key != NULL)
+            free_entry(&cache->commands.entries[i]);
+
+    table_clear(&cache->commands);
+}
+
+char* path_cache_lookup(PathCache* cache, char* command) {
+    if(strchr(command, '/') != NULL)
+        return command;
+
+    validate(cache);
+    size_t length = strlen(command);
+    TableEntry* entry = table_find(&cache->commands, command, length);
+    if(entry != NULL) {
+        PathEntry* path_entry = entry->value;
+        ++path_entry->hits;
+        ++cache->hits;
+        return path_entry->path;
+    }
+
+    ++cache->misses;
+    PathEntry* path_entry = malloc(sizeof(PathEntry));
+    path_entry->path = resolve(cache, command);
+    path_entry->hits = 1;
+    table_insert(&cache->commands, command, length)->value = path_entry;
+    return path_entry->path;
+}
+
+void path_cache_forget(PathCache* cache, char* command) {
+    TableEntry* entry = table_find(&cache->commands, command, strlen(command));
+    if(entry == NULL)
+        return;
+
+    free_entry(entry);
+    table_remove(&cache->commands, entry);
+}
@@ -0,0 +1,12 @@
+#ifndef MYSHELL_PATHCACHE_H
+#define MYSHELL_PATHCACHE_H
+
+#include "typedefs.h"
+
+void path_cache_init(PathCache* cache);
+void path_cache_free(PathCache* cache);
+void path_cache_clear(PathCache* cache);
+char* path_cache_lookup(PathCache* cache, char* command);
+void path_cache_forget(PathCache* cache, char* command);
+
+#endif //MYSHELL_PATHCACHE_H
@@ -0,0 +1,407 @@
+#include "procscan.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+typedef struct {
+    int dir_fd;
+    const ProcessFilter* filter;
+    const int* pids;
+    ProcessInfo* processes;
+    size_t count;
+} ScanRange;
+
+void process_list_init(ProcessList* list) {
+    list->processes = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void process_list_free(ProcessList* list) {
+    free(list->processes);
+    process_list_init(list);
+}
+
+static int parse_pid(const char* name) {
+    int pid = 0;
+    for(const char* c = name; *c != '\0'; ++c) {
+        if(*c < '0' || *c > '9')
+            return 0;
+
+        pid = pid * 10 + (*c - '0');
+    }
+
+    return pid;
+}
+
+// The PIDs come back sorted, which is the order every caller prints them in.
+int list_pids(const char* procfs_path, PidList* list) {
+    DIR* dir = opendir(procfs_path);
+    if(dir == NULL)
+        return -1;
+
+    list->count = 0;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        if(entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+            continue;
+
+        int pid = parse_pid(entry->d_name);
+        if(pid == 0)
+            continue;
+
+        if(list->count == list->capacity) {
+            list->capacity = list->capacity == 0 ? PID_LIST_INITIAL_CAPACITY : list->capacity * 2;
+            list->pids = realloc(list->pids, list->capacity * sizeof(int));
+        }
+
+        list->pids[list->count++] = pid;
+    }
+
+    closedir(dir);
+    qsort(list->pids, list->count, sizeof(int), compare_int);
+    return 0;
+}
+
+static const char* skip_fields(const char* field, int count) {
+    for(int f = 0; f < count && field != NULL; ++f) {
+        field = strchr(field, ' ');
+        if(field != NULL)
+            ++field;
+    }
+
+    return field;
+}
+
+// The name is everything between the first '(' and the last ')', so names that contain spaces or parentheses
+// themselves are kept whole. The line has to be NUL-terminated at its length. Returns 1 as soon as a field
+// fails the filter, which may be NULL, without parsing the rest of the line.
+int parse_stat(const char* line, size_t length, ProcessInfo* info, const ProcessFilter* filter) {
+    const char* end = line + length;
+    const char* open = memchr(line, '(', length);
+    const char* close = end;
+    while(close > line && *--close != ')');
+    if(open == NULL || close <= open || end - close < 5)
+        return -1;
+
+    info->pid = atoi(line);
+    size_t name_length = close - open - 1;
+    if(name_length >= PROCESS_NAME_MAX_LENGTH)
+        name_length = PROCESS_NAME_MAX_LENGTH - 1;
+
+    memcpy(info->name, open + 1, name_length);
+    info->name[name_length] = '\0';
+    if(filter != NULL && filter->name_pattern != NULL && fnmatch(filter->name_pattern, info->name, 0) != 0)
+        return 1;
+
+    info->state = close[2];
+    if(filter != NULL && filter->state != '\0' && info->state != filter->state)
+        return 1;
+
+    info->ppid = atoi(close + 4);
+    if(filter != NULL && filter->ppid != -1 && info->ppid != filter->ppid)
+        return 1;
+
+    info->cpu_ticks = 0;
+    info->rss_pages = 0;
+
+    const char* field = skip_fields(close + 4, 10);
+    if(field != NULL) {
+        char* next;
+        info->cpu_ticks = strtoul(field, &next, 10);
+        info->cpu_ticks += strtoul(next, &next, 10);
+        field = skip_fields(next + (*next == ' '), 8);
+        if(field != NULL)
+            info->rss_pages = atol(field);
+    }
+
+    return 0;
+}
+
+// A process that exits between the directory listing and the read is left out with its pid set to 0.
+static void* scan_range(void* argument) {
+    ScanRange* range = argument;
+    char path[32];
+    char buffer[PROC_STAT_BUFFER_SIZE];
+    struct stat process_stat;
+    for(size_t p = 0; p < range->count; ++p) {
+        ProcessInfo* info = &range->processes[p];
+        info->pid = 0;
+        int name_length = snprintf(path, sizeof(path), "%d/stat", range->pids[p]) - 5;
+        if(range->filter != NULL && range->filter->uid != -1) {
+            path[name_length] = '\0';
+            if(fstatat(range->dir_fd, path, &process_stat, 0) == -1 || process_stat.st_uid != range->filter->uid)
+                continue;
+
+            path[name_length] = '/';
+        }
+
+        int fd = openat(range->dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+            continue;
+
+        ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        close(fd);
+        if(length <= 0)
+            continue;
+
+        buffer[length] = '\0';
+        if(parse_stat(buffer, length, info, range->filter) != 0)
+            info->pid = 0;
+    }
+
+    return NULL;
+}
+
+// The PID range is split evenly between the worker threads, each writing only its own part of the list. Passing
+// 0 threads picks one per PROC_SCAN_PIDS_PER_THREAD processes, up to the number of online CPUs. Only processes
+// that pass the filter, when there is one, are kept.
+int scan_processes(const char* procfs_path, ProcessList* list, int threads, const ProcessFilter* filter) {
+    PidList pids = {NULL, 0, 0};
+    if(list_pids(procfs_path, &pids) == -1)
+        return -1;
+
+    int dir_fd = open(procfs_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd == -1) {
+        free(pids.pids);
+        return -1;
+    }
+
+    if(pids.count > list->capacity) {
+        list->capacity = pids.count;
+        list->processes = realloc(list->processes, list->capacity * sizeof(ProcessInfo));
+    }
+
+    if(threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (int) (pids.count / PROC_SCAN_PIDS_PER_THREAD) + 1;
+        if(threads > cpus)
+            threads = cpus > 0 ? (int) cpus : 1;
+    }
+
+    if(threads > PROC_SCAN_MAX_THREADS)
+        threads = PROC_SCAN_MAX_THREADS;
+
+    ScanRange ranges[PROC_SCAN_MAX_THREADS];
+    pthread_t workers[PROC_SCAN_MAX_THREADS];
+    size_t start = 0;
+    for(int t = 0; t < threads; ++t) {
+        size_t end = pids.count * (t + 1) / threads;
+        ranges[t] = (ScanRange) {dir_fd, filter, pids.pids + start, list->processes + start, end - start};
+        start = end;
+    }
+
+    int started = 1;
+    for(; started < threads; ++started)
+        if(pthread_create(&workers[started], NULL, scan_range, &ranges[started]) != 0)
+            break;
+
+    scan_range(&ranges[0]);
+    for(int t = started; t < threads; ++t)
+        scan_range(&ranges[t]);
+
+    for(int t = 1; t < started; ++t)
+        pthread_join(workers[t], NULL);
+
+    list->count = 0;
+    for(size_t p = 0; p < pids.count; ++p)
+        if(list->processes[p].pid != 0)
+            list->processes[list->count++] = list->processes[p];
+
+    close(dir_fd);
+    free(pids.pids);
+    return 0;
+}
+
+// Links every process to its children, ordered by PID, through a PID hash built in the same pass. Processes
+// whose parent is not in the list are roots; the first is returned, and the rest follow it through next_sibling.
+int index_children(ProcessList* list, int* first_child, int* next_sibling) {
+    size_t slots = 16;
+    while(slots < list->count * 2)
+        slots *= 2;
+
+    int* by_pid = malloc(slots * sizeof(int));
+    memset(by_pid, -1, slots * sizeof(int));
+    for(size_t p = 0; p < list->count; ++p) {
+        size_t slot = (unsigned) list->processes[p].pid * 2654435761u & (slots - 1);
+        while(by_pid[slot] != -1)
+            slot = (slot + 1) & (slots - 1);
+
+        by_pid[slot] = (int) p;
+        first_child[p] = -1;
+    }
+
+    int first_root = -1;
+    for(size_t p = list->count; p-- > 0;) {
+        int ppid = list->processes[p].ppid;
+        size_t slot = (unsigned) ppid * 2654435761u & (slots - 1);
+        while(by_pid[slot] != -1 && list->processes[by_pid[slot]].pid != ppid)
+            slot = (slot + 1) & (slots - 1);
+
+        int* head = by_pid[slot] == -1 || by_pid[slot] == (int) p ? &first_root : &first_child[by_pid[slot]];
+        next_sibling[p] = *head;
+        *head = (int) p;
+    }
+
+    free(by_pid);
+    return first_root;
+}
+
+void process_snapshot_init(ProcessSnapshot* snapshot) {
+    struct rlimit limit;
+    snapshot->dir_fd = -1;
+    snapshot->pids = (PidList) {NULL, 0, 0};
+    snapshot->exited = (PidList) {NULL, 0, 0};
+    snapshot->samples = NULL;
+    snapshot->previous = NULL;
+    snapshot->count = 0;
+    snapshot->capacity = 0;
+    snapshot->open_fds = 0;
+    snapshot->fd_budget = 0;
+    snapshot->taken = (struct timespec) {0, 0};
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur > PROC_SNAPSHOT_RESERVED_FDS)
+        snapshot->fd_budget = limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : limit.rlim_cur - PROC_SNAPSHOT_RESERVED_FDS;
+}
+
+static void release_sample(ProcessSnapshot* snapshot, ProcessSample* sample) {
+    if(sample->fd == -1)
+        return;
+
+    close(sample->fd);
+    sample->fd = -1;
+    --snapshot->open_fds;
+}
+
+void process_snapshot_free(ProcessSnapshot* snapshot) {
+    for(size_t s = 0; s < snapshot->count; ++s)
+        release_sample(snapshot, &snapshot->samples[s]);
+
+    if(snapshot->dir_fd != -1)
+        close(snapshot->dir_fd);
+
+    free(snapshot->pids.pids);
+    free(snapshot->exited.pids);
+    free(snapshot->samples);
+    free(snapshot->previous);
+    process_snapshot_init(snapshot);
+}
+
+static void push_pid(PidList* list, int pid) {
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? PID_LIST_INITIAL_CAPACITY : list->capacity * 2;
+        list->pids = realloc(list->pids, list->capacity * sizeof(int));
+    }
+
+    list->pids[list->count++] = pid;
+}
+
+// The stat file of a live process stays open between refreshes while the descriptor budget allows, since
+// procfs regenerates its contents on every read from offset 0.
+static _Bool read_sample(ProcessSnapshot* snapshot, ProcessSample* sample, int pid, _Bool is_new, double elapsed) {
+    char buffer[PROC_STAT_BUFFER_SIZE];
+    if(sample->fd == -1) {
+        char path[32];
+        snprintf(path, sizeof(path), "%d/stat", pid);
+        sample->fd = openat(snapshot->dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if(sample->fd == -1)
+            return 0;
+
+        ++snapshot->open_fds;
+    }
+
+    ProcessInfo info;
+    ssize_t length = pread(sample->fd, buffer, sizeof(buffer) - 1, 0);
+    if(snapshot->open_fds > snapshot->fd_budget)
+        release_sample(snapshot, sample);
+
+    if(length <= 0)
+        return 0;
+
+    buffer[length] = '\0';
+    if(parse_stat(buffer, length, &info, NULL) == -1)
+        return 0;
+
+    int cpu_tenths = 0;
+    if(!is_new && elapsed > 0)
+        cpu_tenths = (int) ((info.cpu_ticks - sample->info.cpu_ticks) * 1000.0 / (elapsed * sysconf(_SC_CLK_TCK)) + 0.5);
+
+    sample->rss_delta = is_new ? 0 : info.rss_pages - sample->info.rss_pages;
+    sample->changed = is_new || cpu_tenths != sample->cpu_tenths || sample->rss_delta != 0 ||
+                      info.state != sample->info.state || info.ppid != sample->info.ppid ||
+                      strcmp(info.name, sample->info.name) != 0;
+    sample->cpu_tenths = cpu_tenths;
+    sample->info = info;
+    return 1;
+}
+
+// The sorted PID listing is merged with the previous snapshot, so each process is matched with its earlier
+// sample in one pass; processes missing from the listing or gone by the time they are read end up in exited.
+int process_snapshot_refresh(ProcessSnapshot* snapshot, const char* procfs_path) {
+    if(snapshot->dir_fd == -1) {
+        snapshot->dir_fd = open(procfs_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(snapshot->dir_fd == -1)
+            return -1;
+    }
+
+    if(list_pids(procfs_path, &snapshot->pids) == -1)
+        return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = snapshot->taken.tv_sec == 0 ? 0 : (double) (now.tv_sec - snapshot->taken.tv_sec) +
+                                                     (double) (now.tv_nsec - snapshot->taken.tv_nsec) / 1e9;
+    if(snapshot->pids.count > snapshot->capacity) {
+        snapshot->capacity = snapshot->pids.count;
+        snapshot->samples = realloc(snapshot->samples, snapshot->capacity * sizeof(ProcessSample));
+        snapshot->previous = realloc(snapshot->previous, snapshot->capacity * sizeof(ProcessSample));
+    }
+
+    ProcessSample* old = snapshot->samples;
+    ProcessSample* next = snapshot->previous;
+    size_t old_count = snapshot->count;
+    size_t count = 0;
+    size_t o = 0;
+    snapshot->exited.count = 0;
+    for(size_t p = 0; p < snapshot->pids.count || o < old_count;) {
+        if(p == snapshot->pids.count || (o < old_count && old[o].info.pid < snapshot->pids.pids[p])) {
+            release_sample(snapshot, &old[o]);
+            push_pid(&snapshot->exited, old[o++].info.pid);
+            continue;
+        }
+
+        int pid = snapshot->pids.pids[p++];
+        _Bool is_new = o == old_count || old[o].info.pid != pid;
+        ProcessSample* sample = &next[count];
+        if(is_new) {
+            sample->fd = -1;
+            sample->cpu_tenths = 0;
+        } else {
+            *sample = old[o++];
+        }
+
+        if(read_sample(snapshot, sample, pid, is_new, elapsed)) {
+            ++count;
+        } else {
+            release_sample(snapshot, sample);
+            if(!is_new)
+                push_pid(&snapshot->exited, pid);
+        }
+    }
+
+    snapshot->samples = next;
+    snapshot->previous = old;
+    snapshot->count = count;
+    snapshot->taken = now;
+    return 0;
+}
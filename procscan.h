@@ -0,0 +1,18 @@
+#ifndef MYSHELL_PROCSCAN_H
+#define MYSHELL_PROCSCAN_H
+
+#include "typedefs.h"
+
+#include <stddef.h>
+
+void process_list_init(ProcessList* list);
+void process_list_free(ProcessList* list);
+int list_pids(const char* procfs_path, PidList* list);
+int parse_stat(const char* line, size_t length, ProcessInfo* info, const ProcessFilter* filter);
+int scan_processes(const char* procfs_path, ProcessList* list, int threads, const ProcessFilter* filter);
+int index_children(ProcessList* list, int* first_child, int* next_sibling);
+void process_snapshot_init(ProcessSnapshot* snapshot);
+void process_snapshot_free(ProcessSnapshot* snapshot);
+int process_snapshot_refresh(ProcessSnapshot* snapshot, const char* procfs_path);
+
+#endif //MYSHELL_PROCSCAN_H
@@ -1,5 +1,22 @@
+#define _GNU_SOURCE
+
 #include "shell.h"
 #include "utility.h"
+#include "spawner.h"
+#include "pathcache.h"
+#include "table.h"
+#include "dispatch.h"
+#include "history.h"
+#include "lexer.h"
+#include "cmdcache.h"
+#include "multicopy.h"
+#include "procscan.h"
+#include "jobs.h"
+#include "stats.h"
+#include "output.h"
+
+#include <pthread.h>
+#include <limits.h>
 
 const Color colors[NUM_COLORS] = {
         {"red",     COLOR_RED},
@@ -11,124 +28,105 @@ const Color colors[NUM_COLORS] = {
 };
 
 const Command commands[NUM_COMMANDS] = {
-        {"debug",      debug_handler,      "Set or see current debug level"},
-        {"prompt",     prompt_handler,     "Set or see current prompt text"},
-        {"status",     status_handler,     "Get exit status"},
-        {"exit",       exit_handler,       "Exit the shell"},
-        {"help",       help_handler,       "Display help information"},
-        {"print",      print_handler,      "Print the arguments to the standard output"},
-        {"echo",       echo_handler,       "Print the arguments and a new line to the standard output"},
-        {"len",        len_handler,        "Sum the length of all the arguments"},
-        {"sum",        sum_handler,        "Sum all the arguments"},
-        {"calc",       calc_handler,       "Perform operation (2nd arg) on the operands (1st and 3rd arg)"},
-        {"basename",   basename_handler,   "Print the basename of the path"},
-        {"dirname",    dirname_handler,    "Print the directory of the path"},
-        {"dirch",      dirch_handler,      "Change the working directory"},
-        {"dirwd",      dirwd_handler,      "Print the current working directory"},
-        {"dirmk",      dirmk_handler,      "Create a directory"},
-        {"dirrm",      dirrm_handler,      "Remove a directory"},
-        {"dirls",      dirls_handler,      "Print the contents of the directory"},
-        {"rename",     rename_handler,     "Rename the file"},
-        {"unlink",     unlink_handler,     "Remove the directory entry"},
-        {"remove",     remove_handler,     "Remove the file"},
-        {"linkhard",   linkhard_handler,   "Create a hard link"},
-        {"linksoft",   linksoft_handler,   "Create a soft link"},
-        {"linkread",   linkread_handler,   "Read the destination of the symbolic link"},
-        {"linklist",   linklist_handler,   "Find all the hard links to the given file in the current directory"},
-        {"cpcat",      cpcat_handler,      "Commands 'cp' and 'cat' merged into one"},
-        {"pid",        pid_handler,        "PID of the shell process"},
-        {"ppid",       ppid_handler,       "PID of the parent of the shell process"},
-        {"uid",        uid_handler,        "UID of the owner of the shell process"},
-        {"euid",       euid_handler,       "UID of the active owner of the shell process"},
-        {"gid",        gid_handler,        "GID of the group, of which the owner of the shell process is a member of"},
-        {"egid",       egid_handler,       "EGID of the group, of which the owner of the shell process is an active member of"},
-        {"sysinfo",    sysinfo_handler,    "Displays basic information about the system"},
-        {"proc",       proc_handler,       "Set the path to the procfs file system"},
-        {"pids",       pids_handler,       "Display the PIDs of the current processes obtained from procfs"},
-        {"pinfo",      pinfo_handler,      "Display information about current processes"},
-        {"waitone",    waitone_handler,    "Wait for process with specified pid to finish"},
-        {"waitall",    waitall_handler,    "Wait for all child processes to finish"},
-        {"pipes",      pipes_handler,      "Pipe the commands given as arguments"},
-        {"!!",         lastcmd_handler,    "Get the last command used"},
-        {"!n",         nthcmd_handler,     "Get the nth last command used"},
-        {"history",    history_handler,    "Display the history of commands used"},
-        {"alias",      alias_handler,      "Set an alias for a command"},
-        {"unalias",    unalias_handler,    "Remove an alias"},
-        {"aliaslist",  aliaslist_handler,  "List currently active aliases"},
-        {"setcolor",   setcolor_handler,   "Set the color of the prompt text"},
-        {"resetcolor", resetcolor_handler, "Reset the color of the prompt text"},
-        {"colorlist",  colorlist_handler,  "List the available colors"},
-        {"setvar", setvar_handler, "Set the value of a variable"},
-        {"freevar", freevar_handler, "Free the space used up by a variable"},
-        {"varlist", varlist_handler, "List currently active variables"},
+#define BUILTIN(name, function, help_text) {name, function, help_text},
+#include "builtins.def"
+#undef BUILTIN
 };
 
+static void free_alias(Alias* alias) {
+    free(alias->command);
+    free(alias->text);
+    free(alias->words);
+    free(alias->kinds);
+    free(alias);
+}
+
 Shell* start_shell() {
     Shell* shell = malloc(sizeof(Shell));
     shell->input_stream = stdin;
-    shell->output_stream = stdout;
+    output_init(&shell->output, STDOUT_FILENO);
+    shell->output_stream = output_open_stream(&shell->output);
+    shell->error_stream = stderr;
+    stderr = output_open_error_stream(&shell->output);
     shell->prompt_text = malloc((PROMPT_TEXT_MAX_LENGTH + 1) * sizeof(char));
     strcpy(shell->prompt_text, DEFAULT_PROMPT_TEXT);
     shell->debug_level = 0;
     shell->exit_status = 0;
     shell->procfs_path = malloc(DIRECTORY_MAX_LENGTH * sizeof(char));
     strcpy(shell->procfs_path, DEFAULT_PROCFS_PATH);
-    shell->input_redirect = malloc(PATH_MAX_LENGTH * sizeof(char));
-    shell->output_redirect = malloc(PATH_MAX_LENGTH * sizeof(char));
+    shell->buffer = NULL;
+    shell->buffer_size = 0;
+    shell->line.size = BUFFER_SIZE;
+    shell->line.used = 0;
+    shell->line.data = malloc(shell->line.size);
+    shell->token_capacity = INITIAL_TOKEN_CAPACITY;
+    shell->tokens = malloc(shell->token_capacity * sizeof(char*));
+    shell->token_kinds = malloc(shell->token_capacity);
+    shell->token_count = 0;
     shell->is_input_redirected = 0;
     shell->is_output_redirected = 0;
-    shell->history_count = 0;
+    char* history_size = getenv("MYSH_HISTSIZE");
+    history_init(&shell->history, history_size != NULL && atoi(history_size) > 0 ? atoi(history_size)
+                                                                                : DEFAULT_HISTORY_SIZE);
     shell->block_prompt = 0;
     shell->history_index = 0;
-    shell->alias_count = 0;
+    table_init(&shell->aliases);
+    shell->alias_expansion = 0;
     shell->color = NULL;
     shell->color_active = 0;
-    shell->variable_count = 0;
-    for(int i = 0; i < MAX_TOKENS; ++i)
-        shell->is_processed[i] = 0;
-
-    for(int i = 0; i < HISTORY_SIZE; i++)
-        shell->history[i] = NULL;
-
+    table_init(&shell->variables);
+    path_cache_init(&shell->path_cache);
+    command_cache_init(&shell->command_cache, COMMAND_CACHE_SIZE);
+    shell->pipe_size = 0;
+    job_table_init(&shell->jobs);
+    shell->command_line = NULL;
+    shell->interactive = 0;
+    shell->child_max_rss = 0;
+    stats_enabled = getenv("MYSH_STATS") != NULL && atoi(getenv("MYSH_STATS")) > 0;
+    select_scanner(SCAN_AVX2);
     return shell;
 }
 
 void stop_shell() {
     fclose(sh->input_stream);
     fclose(sh->output_stream);
+    fclose(stderr);
+    stderr = sh->error_stream;
+    output_free(&sh->output);
     free(sh->prompt_text);
     free(sh->procfs_path);
-    free(sh->input_redirect);
-    free(sh->output_redirect);
-    for(int i = 0; i < sh->history_count; i++)
-        free(sh->history[i]);
+    free(sh->buffer);
+    free(sh->line.data);
+    free(sh->tokens);
+    free(sh->token_kinds);
+    path_cache_free(&sh->path_cache);
+    command_cache_free(&sh->command_cache);
+    job_table_free(&sh->jobs);
+    for(size_t i = 0; i < sh->variables.capacity; ++i)
+        free(sh->variables.entries[i].value);
 
-    for(int i = 0; i < sh->alias_count; ++i) {
-        free(sh->aliases[i].alias);
-        free(sh->aliases[i].command);
-    }
+    table_free(&sh->variables);
+    history_free(&sh->history);
+
+    for(size_t i = 0; i < sh->aliases.capacity; ++i)
+        if(sh->aliases.entries[i].key != NULL)
+            free_alias(sh->aliases.entries[i].value);
+
+    table_free(&sh->aliases);
 
     free(sh);
 }
 
 void save_to_history(char* command) {
-    if(sh->history_count < HISTORY_SIZE) {
-        sh->history[sh->history_count++] = strdup(command);
-    } else {
-        free(sh->history[0]);
-        for(int i = 1; i < HISTORY_SIZE; ++i)
-            sh->history[i - 1] = sh->history[i];
-
-        sh->history[HISTORY_SIZE - 1] = strdup(command);
-    }
+    history_append(&sh->history, command);
 }
 
 void* find_builtin(char* cmd) {
-    for(int c = 0; c < NUM_COMMANDS; ++c)
-        if(strcmp(commands[c].name, cmd) == 0)
-            return commands[c].function;
+    int slot = dispatch_slots[hash_bytes(cmd, strlen(cmd), DISPATCH_SEED) & DISPATCH_MASK];
+    if(slot == 0 || strcmp(commands[slot - 1].name, cmd) != 0)
+        return NULL;
 
-    return NULL;
+    return commands[slot - 1].function;
 }
 
 char* find_color(char* color_name) {
@@ -140,11 +138,8 @@ char* find_color(char* color_name) {
 }
 
 char* get_value(char* varname) {
-    for(int v = 0; v < sh->variable_count; ++v)
-        if(strcmp(sh->variables[v].name, varname) == 0)
-            return sh->variables[v].value;
-
-    return NULL;
+    TableEntry* entry = table_find(&sh->variables, varname, strlen(varname));
+    return entry == NULL ? NULL : entry->value;
 }
 
 void print_tokens() {
@@ -157,17 +152,17 @@ void handle_redirects() {
     sh->is_input_redirected = 0;
     sh->is_output_redirected = 0;
     for(int t = sh->token_count - 1; t >= 0 && t >= sh->token_count - 3; --t) {
-        size_t len = strlen(sh->tokens[t]);
-        if(len == 1 && sh->tokens[t][0] == '&') {
+        unsigned char kind = sh->token_kinds[t];
+        if(kind == TOKEN_BACKGROUND) {
             sh->background = 1;
             sh->tokens[t] = NULL;
-        } else if(len > 1 && sh->tokens[t][0] == '<') {
+        } else if(kind == TOKEN_INPUT_REDIRECT) {
             sh->is_input_redirected = 1;
-            strcpy(sh->input_redirect, &(sh->tokens[t][1]));
+            sh->input_redirect = &(sh->tokens[t][1]);
             sh->tokens[t] = NULL;
-        } else if(len > 1 && sh->tokens[t][0] == '>') {
+        } else if(kind == TOKEN_OUTPUT_REDIRECT) {
             sh->is_output_redirected = 1;
-            strcpy(sh->output_redirect, &(sh->tokens[t][1]));
+            sh->output_redirect = &(sh->tokens[t][1]);
             sh->tokens[t] = NULL;
         } else {
             break;
@@ -183,223 +178,557 @@ void handle_redirects() {
         if(sh->is_output_redirected)
             fprintf(sh->output_stream, "Output redirect: '%s'\n", sh->output_redirect);
 
-        fflush(sh->output_stream);
+        output_flush(&sh->output);
     }
 }
 
-void expand_variables(char* buffer) {
-    if (buffer == NULL || *buffer == '\0')
-        return;
+// Only the command word is expanded. The words of the alias are copied behind the line in the line
+// arena, since builtins may modify their arguments in place, and an alias that is already being
+// expanded ends the expansion, so recursive aliases terminate.
+void map_aliases() {
+    ++sh->alias_expansion;
+    while(sh->token_count > 0) {
+        TableEntry* entry = table_find(&sh->aliases, sh->tokens[0], strlen(sh->tokens[0]));
+        if(entry == NULL)
+            return;
 
-    char buffer_expanded[BUFFER_SIZE];
-    char* dest = buffer_expanded;
-    for (char* src = buffer; *src != '\0'; ++src) {
-        if (*src == '$' && isalpha(*(src + 1))) {
-            char var_name[MAX_VARNAME_LENGTH];
-            char* var_start = src + 1;
-            char* var_end = var_start;
-            while (isalnum(*var_end) || *var_end == '_')
-                ++var_end;
+        Alias* alias = entry->value;
+        if(alias->expansion == sh->alias_expansion)
+            return;
 
-            int var_length = var_end - var_start;
-            strncpy(var_name, var_start, var_length);
-            var_name[var_length] = '\0';
-            const char* var_value = get_value(var_name);
-            if (var_value)
-                while (*var_value)
-                    *dest++ = *var_value++;
+        alias->expansion = sh->alias_expansion;
+        reserve_tokens(sh->token_count + alias->word_count);
+        reserve_line(alias->text_length);
+        char* words = sh->line.data + sh->line.used;
+        append_line(alias->text, alias->text_length);
+        memmove(&sh->tokens[alias->word_count], &sh->tokens[1], sh->token_count * sizeof(char*));
+        memmove(&sh->token_kinds[alias->word_count], &sh->token_kinds[1], sh->token_count - 1);
+        memcpy(sh->token_kinds, alias->kinds, alias->word_count);
+        for(int w = 0; w < alias->word_count; ++w)
+            sh->tokens[w] = words + (alias->words[w] - alias->text);
 
-            src = var_end - 1;
-        } else {
-            *dest++ = *src;
-        }
+        sh->token_count += alias->word_count - 1;
     }
-
-    *dest = '\0';
-    strcpy(buffer, buffer_expanded);
 }
 
-void tokenize(char* buffer) {
-    sh->token_count = 0;
-    expand_variables(buffer);
-    _Bool quotation_active = 0;
-    _Bool reading = 0;
-    for(int c = 0; buffer[c] != '\0'; ++c) {
-        if(buffer[c] == '"') {
-            quotation_active = !quotation_active;
-            buffer[c] = '\0';
-            continue;
-        }
-
-        if(quotation_active && reading)
-            continue;
+// The redirect files are opened by the shell rather than by the child, so one that cannot be opened is reported
+// as what it is, and an ENOENT from the spawn always means a missing program. A cached path is only forgotten
+// when it is really gone, not when the program's interpreter is. Returns -1 after reporting the failure, with its
+// status in sh->exit_status.
+static pid_t spawn_command(char** argv, int input_fd, int output_fd) {
+    int input_file = -1;
+    int output_file = -1;
+    if(sh->is_input_redirected && (input_file = open(sh->input_redirect, O_RDONLY | O_CLOEXEC)) == -1) {
+        sh->exit_status = errno;
+        perror("open");
+        return -1;
+    }
 
-        if(buffer[c] == '#' && !quotation_active && !reading) {
-            buffer[c] = '\0';
-            return;
-        }
+    if(sh->is_output_redirected &&
+       (output_file = open(sh->output_redirect, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1) {
+        sh->exit_status = errno;
+        perror("open");
+        if(input_file != -1)
+            close(input_file);
 
-        if(quotation_active || buffer[c] != ' ') {
-            if(reading)
-                continue;
+        return -1;
+    }
 
-            sh->tokens[sh->token_count++] = &(buffer[c]);
-            reading = 1;
+    pid_t pid = -1;
+    for(int attempt = 0; attempt < 2; ++attempt) {
+        char* path = path_cache_lookup(&sh->path_cache, argv[0]);
+        if(path == NULL) {
+            errno = ENOENT;
+            break;
         }
 
-        if(quotation_active)
-            continue;
+        pid = spawn_process(path, argv, input_file != -1 ? input_file : input_fd,
+                            output_file != -1 ? output_file : output_fd);
+        if(pid != -1 || path == argv[0] || errno != ENOENT || access(path, F_OK) == 0)
+            break;
 
-        while(buffer[c] == ' ') {
-            reading = 0;
-            if(buffer[c] == '\0')
-                return;
+        path_cache_forget(&sh->path_cache, argv[0]);
+    }
 
-            buffer[c] = '\0';
-        }
+    if(pid == -1) {
+        sh->exit_status = 127;
+        perror(argv[0]);
     }
 
+    if(input_file != -1)
+        close(input_file);
+
+    if(output_file != -1)
+        close(output_file);
+
+    return pid;
+}
+
+static void restore_command(CachedCommand* command) {
+    sh->token_count = 0;
+    sh->line.used = 0;
+    append_line(command->text, command->text_length);
+    reserve_tokens(command->token_count);
+    for(int t = 0; t < command->token_count; ++t)
+        sh->tokens[t] = sh->line.data + command->offsets[t];
+
+    memcpy(sh->token_kinds, command->kinds, command->token_count);
+    sh->token_count = command->token_count;
     sh->tokens[sh->token_count] = NULL;
 }
 
-void map_aliases() {
-    for(int t = 0; t < sh->token_count; ++t)
-        for(int a = 0; a < sh->alias_count; ++a)
-            if(strcmp(sh->aliases[a].alias, sh->tokens[t]) == 0) {
-                sh->tokens[t] = strdup(sh->aliases[a].command);
-                sh->is_processed[t] = 1;
-            }
+static void execute_pipeline();
+
+typedef struct {
+    struct timespec start;
+    struct rusage self;
+    struct rusage children;
+    long child_max_rss;
+} ResourceUsage;
+
+static void begin_usage(ResourceUsage* usage) {
+    usage->child_max_rss = sh->child_max_rss;
+    sh->child_max_rss = 0;
+    getrusage(RUSAGE_SELF, &usage->self);
+    getrusage(RUSAGE_CHILDREN, &usage->children);
+    clock_gettime(CLOCK_MONOTONIC, &usage->start);
 }
 
-void execute_external() {
-    fflush(sh->input_stream);
-    pid_t pid = fork();
-    if(pid == -1) {
+static double timeval_seconds(struct timeval* end, struct timeval* start) {
+    return (double) (end->tv_sec - start->tv_sec) + (double) (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+// Builtins are charged to the shell and external commands to its children, which only count once they have
+// been waited for, so background jobs are left out. The maximum RSS is that of the largest child reaped with
+// wait4(), or the shell's own high-water mark when no child ran. A spawned child runs in the shell's memory
+// until it execs, so the kernel never reports less for it than the shell's own size.
+static void report_usage(ResourceUsage* usage, FILE* stream, const char* label) {
+    output_flush(&sh->output);
+    struct timespec end;
+    struct rusage self;
+    struct rusage children;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    double real = (double) (end.tv_sec - usage->start.tv_sec) + (double) (end.tv_nsec - usage->start.tv_nsec) / 1e9;
+    double user = timeval_seconds(&self.ru_utime, &usage->self.ru_utime) +
+                  timeval_seconds(&children.ru_utime, &usage->children.ru_utime);
+    double system = timeval_seconds(&self.ru_stime, &usage->self.ru_stime) +
+                    timeval_seconds(&children.ru_stime, &usage->children.ru_stime);
+    long max_rss = sh->child_max_rss > 0 ? sh->child_max_rss : self.ru_maxrss;
+    fprintf(stream, "%sreal %.3fs user %.3fs sys %.3fs maxrss %ldK minflt %ld majflt %ld nvcsw %ld nivcsw %ld\n",
+            label, real, user, system, max_rss,
+            self.ru_minflt - usage->self.ru_minflt + children.ru_minflt - usage->children.ru_minflt,
+            self.ru_majflt - usage->self.ru_majflt + children.ru_majflt - usage->children.ru_majflt,
+            self.ru_nvcsw - usage->self.ru_nvcsw + children.ru_nvcsw - usage->children.ru_nvcsw,
+            self.ru_nivcsw - usage->self.ru_nivcsw + children.ru_nivcsw - usage->children.ru_nivcsw);
+    if(sh->child_max_rss < usage->child_max_rss)
+        sh->child_max_rss = usage->child_max_rss;
+}
+
+static void record_child_usage(struct rusage* usage) {
+    if(usage->ru_maxrss > sh->child_max_rss)
+        sh->child_max_rss = usage->ru_maxrss;
+}
+
+// Lines that were run before skip lexing, alias expansion and builtin lookup. The cached tokens are copied
+// back into the line arena, since builtins may modify their arguments in place. External commands are still
+// resolved through the path cache, which notices a changed PATH by itself.
+void execute_line(char* line) {
+    size_t length = strlen(line);
+    sh->command_line = line;
+    if(sh->jobs.running > 0)
+        job_table_poll(&sh->jobs, 0);
+
+    FunctionPointer func;
+    CachedCommand* cached = command_cache_find(&sh->command_cache, line, length);
+    if(cached != NULL) {
+        restore_command(cached);
+        func = cached->function;
+    } else {
+        STATS_PROBE(STAT_TOKENIZE, tokenize(line));
+        _Bool pipeline = memchr(sh->token_kinds, TOKEN_PIPE, sh->token_count) != NULL;
+        if(sh->token_count && !pipeline && strcmp(sh->tokens[0], "unalias"))
+            STATS_PROBE(STAT_MAP_ALIASES, map_aliases());
+
+        func = NULL;
+        if(sh->token_count && !pipeline)
+            STATS_PROBE(STAT_FIND_BUILTIN, func = find_builtin(sh->tokens[0]));
+        if(sh->token_count)
+            command_cache_store(&sh->command_cache, line, length, sh->tokens, sh->token_kinds, sh->token_count, func,
+                                sh->line_variables);
+    }
+
+    if(sh->debug_level)
+        print_tokens();
+
+    // The line is copied for the report, since source and the like reuse the buffer it lives in.
+    ResourceUsage usage;
+    char* profiled_line = NULL;
+    if(sh->debug_level >= DEBUG_LEVEL_USAGE && sh->token_count) {
+        profiled_line = strdup(line);
+        begin_usage(&usage);
+    }
+
+    if(sh->token_count && memchr(sh->token_kinds, TOKEN_PIPE, sh->token_count) != NULL) {
+        execute_pipeline();
+    } else if(sh->token_count) {
+        handle_redirects();
+        if(sh->token_count > 0 && func == NULL)
+            execute_external();
+        else if(sh->token_count > 0)
+            execute_builtin(func);
+    }
+
+    if(profiled_line != NULL) {
+        char label[64];
+        snprintf(label, sizeof(label), "Resources for '%.40s': ", profiled_line);
+        report_usage(&usage, sh->output_stream, label);
+        free(profiled_line);
+    }
+}
+
+// The script is mapped and split on newlines directly; each line is copied into the input buffer only
+// because tokenize() needs it NUL-terminated. Files that cannot be mapped are read in whole.
+void run_script(char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
         sh->exit_status = errno;
-        perror("fork");
+        perror(path);
         return;
     }
 
-    if(pid == 0) {
-        if(sh->is_output_redirected) {
-            int fd = open(sh->output_redirect, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-            if(fd == -1) {
-                sh->exit_status = errno;
-                perror("open");
-                return;
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == -1) {
+        sh->exit_status = errno;
+        perror(path);
+        close(fd);
+        return;
+    }
+
+    size_t size = 0;
+    _Bool mapped = S_ISREG(file_stat.st_mode) && file_stat.st_size > 0;
+    char* data = NULL;
+    if(mapped) {
+        size = file_stat.st_size;
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        mapped = data != MAP_FAILED;
+        if(mapped)
+            madvise(data, size, MADV_SEQUENTIAL);
+    }
+
+    if(!mapped) {
+        size_t capacity = SCRIPT_READ_BLOCK_SIZE;
+        ssize_t bytes_read;
+        size = 0;
+        data = malloc(capacity);
+        while((bytes_read = read(fd, data + size, capacity - size)) > 0) {
+            size += bytes_read;
+            if(size == capacity) {
+                capacity *= 2;
+                data = realloc(data, capacity);
             }
+        }
+    }
+
+    close(fd);
+    char* end = data + size;
+    for(char* line = data; line < end;) {
+        char* newline = memchr(line, '\n', end - line);
+        if(newline == NULL)
+            newline = end;
+
+        size_t length = newline - line;
+        if(length > 0 && line[length - 1] == '\r')
+            --length;
+
+        if(length + 1 > sh->buffer_size) {
+            sh->buffer_size = length + 1;
+            sh->buffer = realloc(sh->buffer, sh->buffer_size);
+        }
 
-            fflush(sh->output_stream);
-            dup2(fd, STDOUT_FILENO);
-            close(fd);
+        memcpy(sh->buffer, line, length);
+        sh->buffer[length] = '\0';
+        if(sh->debug_level)
+            fprintf(sh->output_stream, "Input line: '%s'\n", sh->buffer);
+
+        execute_line(sh->buffer);
+        output_command_done(&sh->output, 0);
+        line = newline + 1;
+    }
+
+    if(mapped)
+        munmap(data, size);
+    else
+        free(data);
+}
+
+static void prepend_history_command(size_t length) {
+    char* history_cmd = history_get(&sh->history, sh->history_index);
+    size_t history_cmd_length = strlen(history_cmd);
+    if(history_cmd_length + length + 1 > sh->buffer_size) {
+        sh->buffer_size = history_cmd_length + length + 1;
+        sh->buffer = realloc(sh->buffer, sh->buffer_size);
+    }
+
+    memmove(sh->buffer + history_cmd_length, sh->buffer, length + 1);
+    memcpy(sh->buffer, history_cmd, history_cmd_length);
+}
+
+void repl(_Bool interactive) {
+    struct stat input_stat;
+    _Bool input_may_block = fstat(fileno(sh->input_stream), &input_stat) == -1 || !S_ISREG(input_stat.st_mode);
+    while(1) {
+        output_command_done(&sh->output, input_may_block);
+        if(interactive && !sh->block_prompt) {
+            notify_jobs();
+            if(sh->color_active)
+                fprintf(sh->output_stream, "%s%s%s>", sh->color, sh->prompt_text, COLOR_RESET);
+            else
+                fprintf(sh->output_stream, "%s>", sh->prompt_text);
+
+            output_flush(&sh->output);
         }
 
-        if(sh->is_input_redirected) {
-            int fd = open(sh->input_redirect, O_RDONLY);
-            if(fd == -1) {
+        ssize_t length = getline(&sh->buffer, &sh->buffer_size, sh->input_stream);
+        if(length == -1) {
+            if(feof(sh->input_stream))
+                break;
+            else {
                 sh->exit_status = errno;
-                perror("open");
-                return;
+                perror("getline");
+                break;
             }
+        }
 
-            dup2(fd, STDIN_FILENO);
-            close(fd);
+        if(sh->block_prompt) {
+            prepend_history_command(length);
+            sh->block_prompt = 0;
         }
 
-        execvp(sh->tokens[0], sh->tokens);
-        sh->exit_status = 127;
-        perror("exec");
-        _exit(sh->exit_status);
-    } else {
-        int status;
-        if(!sh->background)
-            waitpid(pid, &status, 0);
+        remove_newline(sh->buffer);
+        if(strcmp(trim_spaces(sh->buffer), "history") && strcmp(trim_spaces(sh->buffer), "!!") &&
+           strncmp(trim_spaces(sh->buffer), "!n", 2) && strncmp(trim_spaces(sh->buffer), "hsearch", 7))
+            save_to_history(sh->buffer);
 
-        if(WIFEXITED(status))
-            sh->exit_status = WEXITSTATUS(status);
-        else
-            sh->exit_status = 1;
+        if(sh->debug_level)
+            fprintf(sh->output_stream, "Input line: '%s'\n", sh->buffer);
+
+        execute_line(sh->buffer);
     }
 }
 
-void execute_builtin(FunctionPointer function) {
-    if(sh->debug_level) {
-        if(sh->background)
-            fprintf(sh->output_stream, "Executing builtin '%s' in background\n", sh->tokens[0]);
-        else
-            fprintf(sh->output_stream, "Executing builtin '%s' in foreground\n", sh->tokens[0]);
+static void restore_redirects(int fd_in_backup, int fd_out_backup) {
+    if(fd_in_backup != -1) {
+        fflush(sh->input_stream);
+        dup2(fd_in_backup, STDIN_FILENO);
+        close(fd_in_backup);
     }
 
-    int fd_in_backup;
+    if(fd_out_backup != -1) {
+        output_flush(&sh->output);
+        dup2(fd_out_backup, STDOUT_FILENO);
+        close(fd_out_backup);
+    }
+}
+
+static void start_background_job(const pid_t* pids, int count) {
+    Job* job = job_start(&sh->jobs, sh->command_line != NULL ? sh->command_line : sh->tokens[0], pids, count);
+    if(sh->interactive)
+        fprintf(stderr, "[%d] %d\n", job->id, pids[count - 1]);
+}
+
+void execute_external() {
+    fflush(sh->input_stream);
+    output_flush(&sh->output);
+    pid_t pid;
+    STATS_PROBE(STAT_SPAWN, pid = spawn_command(sh->tokens, -1, -1));
+    if(pid == -1)
+        return;
+
+    if(sh->background) {
+        start_background_job(&pid, 1);
+        sh->exit_status = 0;
+        return;
+    }
+
+    int status;
+    struct rusage usage;
+    pid_t waited;
+    while((waited = wait4(pid, &status, 0, &usage)) == -1 && errno == EINTR);
+    if(waited == -1) {
+        sh->exit_status = errno;
+        perror("wait4");
+        return;
+    }
+
+    record_child_usage(&usage);
+
+    if(WIFEXITED(status))
+        sh->exit_status = WEXITSTATUS(status);
+    else
+        sh->exit_status = 1;
+}
+
+// Returns -1 when a redirect cannot be opened, after undoing the ones already made.
+static int redirect_builtin(int* fd_in_backup, int* fd_out_backup) {
+    *fd_in_backup = -1;
+    *fd_out_backup = -1;
     if(sh->is_input_redirected) {
-        fd_in_backup = dup(STDIN_FILENO);
         int fd = open(sh->input_redirect, O_RDONLY);
         if(fd == -1) {
             sh->exit_status = errno;
             perror("open");
-            return;
+            return -1;
         }
 
         fflush(sh->input_stream);
+        *fd_in_backup = dup(STDIN_FILENO);
         dup2(fd, STDIN_FILENO);
         close(fd);
     }
 
-    int fd_out_backup;
     if(sh->is_output_redirected) {
-        fflush(sh->output_stream);
-        fd_out_backup = dup(STDOUT_FILENO);
         int fd = open(sh->output_redirect, O_CREAT | O_WRONLY | O_TRUNC, 0666);
         if(fd == -1) {
             sh->exit_status = errno;
             perror("open");
-            return;
+            restore_redirects(*fd_in_backup, -1);
+            return -1;
         }
 
-        fflush(sh->output_stream);
+        output_flush(&sh->output);
+        *fd_out_backup = dup(STDOUT_FILENO);
         dup2(fd, STDOUT_FILENO);
         close(fd);
     }
 
+    return 0;
+}
+
+void execute_builtin(FunctionPointer function) {
+    if(sh->debug_level) {
+        if(sh->background)
+            fprintf(sh->output_stream, "Executing builtin '%s' in background\n", sh->tokens[0]);
+        else
+            fprintf(sh->output_stream, "Executing builtin '%s' in foreground\n", sh->tokens[0]);
+    }
+
+    int fd_in_backup;
+    int fd_out_backup;
+    int redirected;
+    STATS_PROBE(STAT_REDIRECT, redirected = redirect_builtin(&fd_in_backup, &fd_out_backup));
+    if(redirected == -1)
+        return;
+
     if(sh->background) {
         fflush(sh->input_stream);
+        output_flush(&sh->output);
         pid_t pid = fork();
         if(pid < 0) {
             sh->exit_status = errno;
             perror("fork");
+            restore_redirects(fd_in_backup, fd_out_backup);
             return;
         }
 
         if(pid == 0) {
             function();
+            output_flush(&sh->output);
             _exit(sh->exit_status);
         }
+
+        start_background_job(&pid, 1);
+        sh->exit_status = 0;
     } else {
         function();
     }
 
-    if(sh->is_input_redirected) {
-        fflush(sh->input_stream);
-        dup2(fd_in_backup, STDIN_FILENO);
-        close(fd_in_backup);
+    restore_redirects(fd_in_backup, fd_out_backup);
+}
+
+void hash_handler() {
+    PathCache* cache = &sh->path_cache;
+    sh->exit_status = 0;
+    if(sh->token_count > 1 && strcmp(sh->tokens[1], "-r") == 0) {
+        path_cache_clear(cache);
+        return;
     }
 
-    if(sh->is_output_redirected) {
-        fflush(sh->output_stream);
-        dup2(fd_out_backup, STDOUT_FILENO);
-        close(fd_out_backup);
+    if(sh->token_count > 1) {
+        for(int t = 1; t < sh->token_count; ++t) {
+            path_cache_forget(cache, sh->tokens[t]);
+            if(path_cache_lookup(cache, sh->tokens[t]) == NULL) {
+                fprintf(stderr, "hash: %s: not found\n", sh->tokens[t]);
+                sh->exit_status = 1;
+            }
+        }
+
+        return;
+    }
+
+    if(cache->commands.count == 0) {
+        fprintf(sh->output_stream, "hash: hash table empty\n");
+    } else {
+        fprintf(sh->output_stream, "hits\tcommand\n");
+        for(size_t i = 0; i < cache->commands.capacity; ++i) {
+            TableEntry* entry = &cache->commands.entries[i];
+            if(entry->key == NULL)
+                continue;
+
+            PathEntry* path_entry = entry->value;
+            if(path_entry->path == NULL)
+                fprintf(sh->output_stream, "%4lu\t%s: not found\n", path_entry->hits, entry->key);
+            else
+                fprintf(sh->output_stream, "%4lu\t%s\n", path_entry->hits, path_entry->path);
+        }
+    }
+
+    fprintf(sh->output_stream, "Lookups: %lu hits, %lu misses\n", cache->hits, cache->misses);
+}
+
+void cmdcache_handler() {
+    CommandCache* cache = &sh->command_cache;
+    sh->exit_status = 0;
+    if(sh->token_count > 1 && strcmp(sh->tokens[1], "-r") == 0) {
+        cache->hits = 0;
+        cache->misses = 0;
+        return;
     }
+
+    if(sh->token_count > 1 && strcmp(sh->tokens[1], "-c") == 0) {
+        command_cache_clear(cache);
+        return;
+    }
+
+    unsigned long lookups = cache->hits + cache->misses;
+    fprintf(sh->output_stream, "Lines: %d of %d cached\n", cache->count, cache->capacity);
+    fprintf(sh->output_stream, "Lookups: %lu hits, %lu misses (%.1f%% hit rate)\n", cache->hits, cache->misses,
+            lookups == 0 ? 0.0 : 100.0 * cache->hits / lookups);
 }
 
 void varlist_handler() {
     sh->exit_status = 0;
-    if(sh->variable_count == 0) {
+    if(sh->variables.count == 0) {
         fprintf(sh->output_stream, "No variables set\n");
         return;
     }
 
-    for(int v = 0; v < sh->variable_count; ++v)
-        fprintf(sh->output_stream, "%s = %s\n", sh->variables[v].name, sh->variables[v].value);
+    TableEntry** sorted = malloc(sh->variables.count * sizeof(TableEntry*));
+    size_t variable_count = 0;
+    for(size_t i = 0; i < sh->variables.capacity; ++i)
+        if(sh->variables.entries[i].key != NULL)
+            sorted[variable_count++] = &sh->variables.entries[i];
+
+    qsort(sorted, variable_count, sizeof(TableEntry*), compare_table_entries);
+    for(size_t v = 0; v < variable_count; ++v) {
+        output_string(&sh->output, sorted[v]->key);
+        output_write(&sh->output, " = ", 3);
+        output_string(&sh->output, sorted[v]->value);
+        output_char(&sh->output, '\n');
+    }
+
+    free(sorted);
 }
 
 void freevar_handler() {
@@ -410,373 +739,1408 @@ void freevar_handler() {
     }
 
     const char* name = sh->tokens[1];
-    for (int i = 0; i < sh->variable_count; ++i) {
-        if (strcmp(sh->variables[i].name, name) == 0) {
-            free(sh->variables[i].value);
-            free(sh->variables[i].name);
-            sh->variables[i] = sh->variables[sh->variable_count - 1];
-            --sh->variable_count;
-            sh->exit_status = 0;
-            return;
+    TableEntry* entry = table_find(&sh->variables, name, strlen(name));
+    if(entry == NULL) {
+        fprintf(sh->output_stream, "Variable '%s' wasn't set\n", name);
+        sh->exit_status = 1;
+        return;
+    }
+
+    free(entry->value);
+    table_remove(&sh->variables, entry);
+    command_cache_forget_variable(&sh->command_cache, name, strlen(name));
+    sh->exit_status = 0;
+}
+
+void setvar_handler() {
+    char* equals_sign = sh->token_count < 2 ? NULL : strchr(sh->tokens[1], '=');
+    if(equals_sign == NULL || equals_sign == sh->tokens[1]) {
+        fprintf(sh->output_stream, "Usage: setvar 'varname'='value'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    const char* name = sh->tokens[1];
+    const char* value = equals_sign + 1;
+    TableEntry* entry = table_insert(&sh->variables, name, equals_sign - name);
+    free(entry->value);
+    entry->value = strdup(value);
+    command_cache_forget_variable(&sh->command_cache, name, equals_sign - name);
+    sh->exit_status = 0;
+}
+
+void colorlist_handler() {
+    fprintf(sh->output_stream, "Available colors:\n");
+    for(int c = 0; c < NUM_COLORS; ++c)
+        fprintf(sh->output_stream, "%s\n", colors[c].name);
+}
+
+void resetcolor_handler() {
+    if(sh->color != NULL)
+        free(sh->color);
+
+    sh->color_active = 0;
+    sh->exit_status = 0;
+}
+
+void setcolor_handler() {
+    if(sh->token_count < 2) {
+        fprintf(sh->output_stream, "Usage: setcolor 'color'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    char* color_code = find_color(sh->tokens[1]);
+    if(color_code == NULL) {
+        fprintf(sh->output_stream, "Invalid color. Try 'colorlist'.\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    if(sh->color != NULL)
+        free(sh->color);
+
+    sh->color = strdup(color_code);
+    sh->color_active = 1;
+    sh->exit_status = 0;
+}
+
+static Alias* create_alias(char* command) {
+    Alias* alias = malloc(sizeof(Alias));
+    size_t length = strlen(command);
+    alias->command = strdup(command);
+    alias->text = malloc(length + 1);
+    alias->words = malloc((length / 2 + 1) * sizeof(char*));
+    alias->word_count = 0;
+    alias->expansion = 0;
+
+    char* dest = alias->text;
+    _Bool quotation_active = 0;
+    _Bool reading = 0;
+    for(char* src = command; *src != '\0'; ++src) {
+        if(*src == ' ' && !quotation_active) {
+            if(reading)
+                *dest++ = '\0';
+
+            reading = 0;
+            continue;
         }
+
+        if(!reading)
+            alias->words[alias->word_count++] = dest;
+
+        reading = 1;
+        if(*src == '"')
+            quotation_active = !quotation_active;
+        else
+            *dest++ = *src;
+    }
+
+    if(reading)
+        *dest++ = '\0';
+
+    alias->text_length = dest - alias->text;
+    alias->kinds = malloc(alias->word_count + 1);
+    for(int w = 0; w < alias->word_count; ++w)
+        alias->kinds[w] = classify_word(alias->words[w]);
+
+    return alias;
+}
+
+void alias_handler() {
+    if(sh->token_count < 3) {
+        fprintf(sh->output_stream, "Usage: alias 'command name' 'alias name'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    char* command = sh->tokens[1];
+    char* name = sh->tokens[2];
+    if(find_builtin(name) != NULL) {
+        fprintf(sh->output_stream, "Alias name cannot be another built-in command\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    Alias* alias = create_alias(command);
+    TableEntry* entry = table_insert(&sh->aliases, name, strlen(name));
+    if(entry->value != NULL)
+        free_alias(entry->value);
+
+    entry->value = alias;
+    command_cache_clear(&sh->command_cache);
+    fprintf(sh->output_stream, "Alias '%s' added\n", name);
+    sh->exit_status = 0;
+}
+
+void unalias_handler() {
+    if(sh->token_count < 2) {
+        fprintf(sh->output_stream, "Usage: unalias 'alias name'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    char* name = sh->tokens[1];
+    TableEntry* entry = table_find(&sh->aliases, name, strlen(name));
+    if(entry == NULL) {
+        fprintf(sh->output_stream, "Alias not found\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    free_alias(entry->value);
+    table_remove(&sh->aliases, entry);
+    command_cache_clear(&sh->command_cache);
+    fprintf(sh->output_stream, "Alias '%s' removed\n", name);
+    sh->exit_status = 0;
+}
+
+void aliaslist_handler() {
+    if(sh->aliases.count == 0)
+        fprintf(sh->output_stream, "No active aliases\n");
+
+    TableEntry** sorted = malloc(sh->aliases.count * sizeof(TableEntry*));
+    size_t alias_count = 0;
+    for(size_t i = 0; i < sh->aliases.capacity; ++i)
+        if(sh->aliases.entries[i].key != NULL)
+            sorted[alias_count++] = &sh->aliases.entries[i];
+
+    qsort(sorted, alias_count, sizeof(TableEntry*), compare_table_entries);
+    for(size_t a = 0; a < alias_count; ++a)
+        fprintf(sh->output_stream, "alias %s='%s'\n", sorted[a]->key, ((Alias*) sorted[a]->value)->command);
+
+    free(sorted);
+    sh->exit_status = 0;
+}
+
+void source_handler() {
+    if(sh->token_count < 2) {
+        fprintf(sh->output_stream, "Usage: source 'file'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    run_script(sh->tokens[1]);
+}
+
+void history_handler() {
+    sh->exit_status = 0;
+    if(sh->history.count < 2) {
+        fprintf(sh->output_stream, "History is empty.\n");
+        return;
+    }
+
+    for(size_t i = 0; i < sh->history.count; ++i) {
+        output_long(&sh->output, (long) (sh->history.count - i), 0);
+        output_write(&sh->output, ": ", 2);
+        output_string(&sh->output, history_get(&sh->history, i));
+        output_char(&sh->output, '\n');
+    }
+}
+
+static void recall_history(size_t index) {
+    sh->block_prompt = 1;
+    sh->history_index = index;
+    fprintf(sh->output_stream, "%s>%s", sh->prompt_text, history_get(&sh->history, index));
+}
+
+static void reverse_search() {
+    char query[BUFFER_SIZE];
+    char previous_query[BUFFER_SIZE] = "";
+    size_t matches[HISTORY_SEARCH_LIMIT];
+    size_t found = 0;
+    size_t skip = 0;
+    while(1) {
+        fprintf(sh->output_stream, "(reverse-search): ");
+        output_flush(&sh->output);
+        if(fgets(query, sizeof(query), sh->input_stream) == NULL) {
+            sh->exit_status = 1;
+            return;
+        }
+
+        remove_newline(query);
+        if(query[0] == '\0')
+            break;
+
+        skip = strcmp(query, previous_query) == 0 && skip + 1 < found ? skip + 1 : 0;
+        strcpy(previous_query, query);
+        found = history_search(&sh->history, query, 0, matches, HISTORY_SEARCH_LIMIT);
+        if(found == 0)
+            fprintf(sh->output_stream, "`%s': no match\n", query);
+        else
+            fprintf(sh->output_stream, "`%s': %s\n", query, history_get(&sh->history, matches[skip]));
+    }
+
+    if(found == 0) {
+        sh->exit_status = 1;
+        return;
+    }
+
+    recall_history(matches[skip]);
+    sh->exit_status = 0;
+}
+
+void hsearch_handler() {
+    _Bool prefix = 0;
+    _Bool recall = 0;
+    int t = 1;
+    for(; t < sh->token_count && sh->tokens[t][0] == '-'; ++t) {
+        if(strcmp(sh->tokens[t], "-p") == 0)
+            prefix = 1;
+        else if(strcmp(sh->tokens[t], "-r") == 0)
+            recall = 1;
+        else
+            break;
+    }
+
+    if(recall && t == sh->token_count) {
+        reverse_search();
+        return;
+    }
+
+    if(t != sh->token_count - 1) {
+        fprintf(sh->output_stream, "Usage: hsearch [-p] [-r] 'pattern'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    size_t matches[HISTORY_SEARCH_LIMIT];
+    size_t found = history_search(&sh->history, sh->tokens[t], prefix, matches, recall ? 1 : HISTORY_SEARCH_LIMIT);
+    sh->exit_status = found == 0;
+    if(recall && found > 0) {
+        recall_history(matches[0]);
+        return;
+    }
+
+    for(size_t m = 0; m < found; ++m)
+        fprintf(sh->output_stream, "%zu: %s\n", sh->history.count - matches[m], history_get(&sh->history, matches[m]));
+}
+
+void nthcmd_handler() {
+    if(sh->token_count < 2) {
+        fprintf(sh->output_stream, "Not enough input arguments. See 'help'\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    int n = atoi(sh->tokens[1]);
+    if(n < 1) {
+        fprintf(sh->output_stream, "Provided n has to be a positive number\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    if((size_t) n > sh->history.count) {
+        fprintf(sh->output_stream, "Command number %d does not exit. Currently only %zu commands in history\n", n,
+                sh->history.count);
+        sh->exit_status = 1;
+        return;
+    }
+
+    sh->block_prompt = 1;
+    sh->history_index = sh->history.count - n;
+    char* nth_cmd = history_get(&sh->history, sh->history_index);
+    fprintf(sh->output_stream, "%s>%s", sh->prompt_text, nth_cmd);
+    sh->exit_status = 0;
+}
+
+void lastcmd_handler() {
+    if(sh->history.count < 1) {
+        fprintf(sh->output_stream, "History empty\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    sh->block_prompt = 1;
+    sh->history_index = sh->history.count - 1;
+    fprintf(sh->output_stream, "%s>%s", sh->prompt_text, history_get(&sh->history, sh->history_index));
+    sh->exit_status = 0;
+}
+
+static int wait_status(pid_t pid) {
+    int status;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) == -1)
+        return errno;
+
+    record_child_usage(&usage);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// A stage that only copies its input to its output, which is cpcat without files.
+static _Bool is_pass_through(CachedCommand* stage) {
+    if(stage->function != cpcat_handler)
+        return 0;
+
+    for(int t = 1; t < stage->token_count; ++t)
+        if(stage->kinds[t] != TOKEN_WORD || strcmp(stage->text + stage->offsets[t], "-") != 0)
+            return 0;
+
+    return 1;
+}
+
+// Builtins that only report and never read their input can run in the shell process. Every other builtin
+// either changes the shell, which a stage of a pipeline must not do, or reads its input, and gets a process.
+static _Bool runs_in_shell(CachedCommand* stage) {
+    static const FunctionPointer reporters[] = {
+            print_handler, echo_handler, len_handler, sum_handler, calc_handler, basename_handler, dirname_handler,
+            dirwd_handler, dirls_handler, linkread_handler, linklist_handler, pid_handler, ppid_handler, uid_handler,
+            euid_handler, gid_handler, egid_handler, sysinfo_handler, pids_handler, pinfo_handler, pfind_handler,
+            status_handler, help_handler, history_handler, aliaslist_handler, colorlist_handler, varlist_handler,
+    };
+
+    for(size_t r = 0; r < sizeof(reporters) / sizeof(reporters[0]); ++r)
+        if(stage->function == reporters[r])
+            return 1;
+
+    return 0;
+}
+
+typedef struct {
+    pthread_t thread;
+    int input_fd;
+    int output_fd;
+    int status;
+    int stage;
+} Relay;
+
+// SIGPIPE is blocked so a reader that exits early ends the copy with EPIPE instead of killing the shell.
+static void* run_relay(void* argument) {
+    Relay* relay = argument;
+    sigset_t pipe_mask;
+    sigemptyset(&pipe_mask);
+    sigaddset(&pipe_mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_mask, NULL);
+    relay->status = copy_data(relay->input_fd, relay->output_fd) == -1 ? errno : 0;
+    if(relay->input_fd != STDIN_FILENO)
+        close(relay->input_fd);
+
+    if(relay->output_fd != STDOUT_FILENO)
+        close(relay->output_fd);
+
+    return NULL;
+}
+
+// A pipeline runs in the background when & ends its last stage, before or after the redirects.
+static _Bool runs_in_background(CachedCommand* stage) {
+    for(int t = stage->token_count - 1; t >= 0 && t >= stage->token_count - 3; --t) {
+        if(stage->kinds[t] == TOKEN_BACKGROUND)
+            return 1;
+
+        if(stage->kinds[t] != TOKEN_INPUT_REDIRECT && stage->kinds[t] != TOKEN_OUTPUT_REDIRECT)
+            break;
+    }
+
+    return 0;
+}
+
+// A reader that exited early fails the writes with EPIPE. The SIGPIPE raised with them is blocked and then
+// discarded, so it does not kill the shell.
+static void run_builtin_in_shell(FunctionPointer function, int output_fd) {
+    sigset_t pipe_mask;
+    sigset_t old_mask;
+    sigemptyset(&pipe_mask);
+    sigaddset(&pipe_mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_mask, &old_mask);
+    int fd_out_backup = output_fd != -1 ? dup(STDOUT_FILENO) : -1;
+    if(output_fd != -1)
+        dup2(output_fd, STDOUT_FILENO);
+
+    execute_builtin(function);
+    restore_redirects(-1, fd_out_backup);
+    struct timespec no_wait = {0, 0};
+    while(sigtimedwait(&pipe_mask, NULL, &no_wait) == SIGPIPE);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+// The child closes the pipes of the other stages, or their readers would never see the end of their input. Some
+// of them were closed in the shell already, and nothing has reused their numbers since.
+static pid_t fork_builtin_stage(FunctionPointer function, int input_fd, int output_fd, int (* pipes)[2],
+                                int pipe_count) {
+    fflush(sh->input_stream);
+    output_flush(&sh->output);
+    pid_t pid = fork();
+    if(pid != 0)
+        return pid;
+
+    if(input_fd != -1)
+        dup2(input_fd, STDIN_FILENO);
+
+    if(output_fd != -1)
+        dup2(output_fd, STDOUT_FILENO);
+
+    for(int p = 0; p < pipe_count; ++p) {
+        close(pipes[p][0]);
+        close(pipes[p][1]);
+    }
+
+    execute_builtin(function);
+    output_flush(&sh->output);
+    _exit(sh->exit_status);
+}
+
+// Stages are joined by pipes and run concurrently: external commands and the builtins that may change the shell
+// as processes, pass-through stages as threads that splice from one pipe into the next, and the builtins of
+// runs_in_shell() in the shell process, so they cost no fork. Stages start from the last one, so a builtin run in
+// the shell writes into a pipe that already has its reader and never waits for a stage that has not started.
+static void run_pipeline(CachedCommand** stages, int count) {
+    output_flush(&sh->output);
+
+    // Relay threads and builtin stages run inside the shell, so a pipeline ending in & runs in a forked copy of
+    // it, which is the job, and the prompt comes back at once.
+    if(runs_in_background(stages[count - 1])) {
+        pid_t pid = fork();
+        if(pid == -1) {
+            sh->exit_status = errno;
+            perror("fork");
+            return;
+        }
+
+        if(pid > 0) {
+            start_background_job(&pid, 1);
+            sh->exit_status = 0;
+            return;
+        }
+    }
+
+    int pipes[count][2];
+    pid_t pids[count];
+    int pid_stages[count];
+    Relay relays[count];
+    int spawned = 0;
+    int relayed = 0;
+    int status = 0;
+    int pipe_count = 0;
+    for(; pipe_count < count - 1; ++pipe_count) {
+        if(pipe2(pipes[pipe_count], O_CLOEXEC) == -1) {
+            status = errno;
+            perror("pipe");
+            break;
+        }
+
+        if(sh->pipe_size > 0)
+            fcntl(pipes[pipe_count][1], F_SETPIPE_SZ, sh->pipe_size);
+    }
+
+    for(int s = count - 1; s >= 0 && pipe_count == count - 1; --s) {
+        int input_fd = s > 0 ? pipes[s - 1][0] : -1;
+        int output_fd = s < count - 1 ? pipes[s][1] : -1;
+        int stage_status = 0;
+        restore_command(stages[s]);
+        handle_redirects();
+        sh->background = 0;
+        if(sh->token_count == 0) {
+            stage_status = 0;
+        } else if(is_pass_through(stages[s]) && !sh->is_input_redirected && !sh->is_output_redirected) {
+            Relay* relay = &relays[relayed];
+            relay->input_fd = input_fd == -1 ? STDIN_FILENO : input_fd;
+            relay->output_fd = output_fd == -1 ? STDOUT_FILENO : output_fd;
+            relay->stage = s;
+            if(pthread_create(&relay->thread, NULL, run_relay, relay) == 0) {
+                // The relay closes the descriptors when it is done.
+                ++relayed;
+                input_fd = -1;
+                output_fd = -1;
+            } else {
+                perror("pthread_create");
+                stage_status = 1;
+            }
+        } else if(runs_in_shell(stages[s])) {
+            run_builtin_in_shell(stages[s]->function, output_fd);
+            stage_status = sh->exit_status;
+        } else {
+            pid_t pid;
+            if(stages[s]->function != NULL)
+                pid = fork_builtin_stage(stages[s]->function, input_fd, output_fd, pipes, pipe_count);
+            else
+                pid = spawn_command(sh->tokens, input_fd, output_fd);
+
+            if(pid == -1 && stages[s]->function != NULL) {
+                stage_status = errno;
+                perror("fork");
+            } else if(pid == -1) {
+                stage_status = sh->exit_status;
+            } else {
+                pid_stages[spawned] = s;
+                pids[spawned++] = pid;
+            }
+        }
+
+        // The status of the last stage is the status of the pipeline, including when it never started.
+        if(s == count - 1)
+            status = stage_status;
+
+        if(input_fd != -1)
+            close(input_fd);
+
+        if(output_fd != -1)
+            close(output_fd);
+    }
+
+    // Without all the pipes no stage was started.
+    if(pipe_count < count - 1) {
+        for(int p = 0; p < pipe_count; ++p) {
+            close(pipes[p][0]);
+            close(pipes[p][1]);
+        }
+    }
+
+    for(int joined = 0; joined < relayed; ++joined) {
+        pthread_join(relays[joined].thread, NULL);
+        if(relays[joined].stage == count - 1)
+            status = relays[joined].status;
+    }
+
+    for(int waited = 0; waited < spawned; ++waited) {
+        int stage_status = wait_status(pids[waited]);
+        if(pid_stages[waited] == count - 1)
+            status = stage_status;
+    }
+
+    sh->exit_status = status;
+    if(runs_in_background(stages[count - 1])) {
+        output_flush(&sh->output);
+        _exit(status);
+    }
+}
+
+// Snapshots the command in the token buffer as one stage of a pipeline, after alias expansion.
+static CachedCommand* prepare_stage() {
+    if(strcmp(sh->tokens[0], "unalias"))
+        map_aliases();
+
+    return command_create("", 0, sh->tokens, sh->token_kinds, sh->token_count, find_builtin(sh->tokens[0]), 0);
+}
+
+static void free_stages(CachedCommand** stages, int count) {
+    for(int s = 0; s < count; ++s)
+        free(stages[s]);
+}
+
+// Each stage of a | pipeline is alias-expanded and resolved on its own, and takes its own redirects.
+static void execute_pipeline() {
+    ResourceUsage usage;
+    _Bool timed = strcmp(sh->tokens[0], "time") == 0;
+    if(timed) {
+        memmove(sh->tokens, &sh->tokens[1], sh->token_count * sizeof(char*));
+        memmove(sh->token_kinds, &sh->token_kinds[1], --sh->token_count);
+        begin_usage(&usage);
+    }
+
+    int count = 1;
+    for(int t = 0; t < sh->token_count; ++t)
+        count += sh->token_kinds[t] == TOKEN_PIPE;
+
+    CachedCommand* line = command_create("", 0, sh->tokens, sh->token_kinds, sh->token_count, NULL, 0);
+    CachedCommand* stages[count];
+    int prepared = 0;
+    for(int t = 0, first = 0; t <= line->token_count; ++t) {
+        if(t < line->token_count && line->kinds[t] != TOKEN_PIPE)
+            continue;
+
+        if(t == first) {
+            fprintf(stderr, "syntax error near '|'\n");
+            break;
+        }
+
+        restore_command(line);
+        memmove(sh->tokens, &sh->tokens[first], (t - first) * sizeof(char*));
+        memmove(sh->token_kinds, &sh->token_kinds[first], t - first);
+        sh->token_count = t - first;
+        sh->tokens[sh->token_count] = NULL;
+        stages[prepared++] = prepare_stage();
+        first = t + 1;
+    }
+
+    if(prepared == count)
+        run_pipeline(stages, count);
+    else
+        sh->exit_status = 1;
+
+    free_stages(stages, prepared);
+    free(line);
+    if(timed)
+        report_usage(&usage, stderr, "");
+}
+
+// Every stage is lexed and resolved once, up front, before any of them runs. The stage strings are copied
+// first, since lexing reuses the line arena they live in.
+void pipes_handler() {
+    if(sh->token_count < 3) {
+        fprintf(stderr, "pipes: at least two stages required\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    int count = sh->token_count - 1;
+    char* lines[count];
+    for(int s = 0; s < count; ++s)
+        lines[s] = strdup(sh->tokens[s + 1]);
+
+    CachedCommand* stages[count];
+    int prepared = 0;
+    for(; prepared < count; ++prepared) {
+        tokenize(lines[prepared]);
+        if(sh->token_count == 0) {
+            fprintf(stderr, "pipes: stage %d is empty\n", prepared + 1);
+            break;
+        }
+
+        stages[prepared] = prepare_stage();
+    }
+
+    if(prepared == count)
+        run_pipeline(stages, count);
+    else
+        sh->exit_status = 1;
+
+    for(int s = 0; s < count; ++s)
+        free(lines[s]);
+
+    free_stages(stages, prepared);
+}
+
+// The kernel rounds the size up to a power of two pages, and only privileged users may go beyond
+// /proc/sys/fs/pipe-max-size, so the size is tried on a pipe before it is kept.
+void pipesize_handler() {
+    sh->exit_status = 0;
+    if(sh->token_count == 1) {
+        if(sh->pipe_size == 0)
+            fprintf(sh->output_stream, "default\n");
+        else
+            fprintf(sh->output_stream, "%d\n", sh->pipe_size);
+
+        return;
+    }
+
+    char* end;
+    long size = strtol(sh->tokens[1], &end, 10);
+    if(*end == 'k' || *end == 'K') {
+        size <<= 10;
+        ++end;
+    } else if(*end == 'm' || *end == 'M') {
+        size <<= 20;
+        ++end;
+    }
+
+    if(*end != '\0' || size < 0 || size > INT_MAX) {
+        fprintf(sh->output_stream, "Usage: pipesize [bytes[k|m]] (0 for the default)\n");
+        sh->exit_status = 1;
+        return;
+    }
+
+    if(size == 0) {
+        sh->pipe_size = 0;
+        return;
+    }
+
+    int fds[2];
+    if(pipe(fds) == -1) {
+        sh->exit_status = errno;
+        perror("pipesize");
+        return;
+    }
+
+    int actual = fcntl(fds[1], F_SETPIPE_SZ, (int) size);
+    if(actual == -1) {
+        sh->exit_status = errno;
+        perror("pipesize");
+    } else {
+        sh->pipe_size = actual;
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void waitall_handler() {
+    if(sh->jobs.running == 0)
+        return;
+
+    output_flush(&sh->output);
+    while(sh->jobs.running > 0 && job_table_poll(&sh->jobs, -1) >= 0);
+    sh->exit_status = sh->jobs.last_status;
+}
+
+void waitone_handler() {
+    output_flush(&sh->output);
+    if(sh->token_count > 1) {
+        JobProcess* process = job_find_process(&sh->jobs, atoi(sh->tokens[1]));
+        sh->exit_status = process != NULL ? job_wait_process(&sh->jobs, process) : 0;
+        return;
+    }
+
+    if(sh->jobs.running > 0 && job_table_poll(&sh->jobs, -1) > 0)
+        sh->exit_status = sh->jobs.last_status;
+    else
+        sh->exit_status = 0;
+}
+
+static void print_job(Job* job) {
+    char state[32];
+    if(job->running > 0)
+        strcpy(state, "Running");
+    else if(job->status == 0)
+        strcpy(state, "Done");
+    else
+        snprintf(state, sizeof(state), "Exit %d", job->status);
+
+    fprintf(sh->output_stream, "[%d]  %-10s %s\n", job->id, state, job->command);
+}
+
+// Finished jobs are reported once, by jobs or before the next prompt, and then forgotten.
+void notify_jobs() {
+    if(sh->jobs.count == 0)
+        return;
+
+    if(sh->jobs.running > 0)
+        job_table_poll(&sh->jobs, 0);
+
+    for(int s = 0; s < sh->jobs.count; ++s) {
+        Job* job = sh->jobs.slots[s];
+        if(job != NULL && job->running == 0) {
+            print_job(job);
+            job_remove(&sh->jobs, job);
+        }
+    }
+}
+
+void jobs_handler() {
+    if(sh->jobs.running > 0)
+        job_table_poll(&sh->jobs, 0);
+
+    for(int s = 0; s < sh->jobs.count; ++s) {
+        Job* job = sh->jobs.slots[s];
+        if(job == NULL)
+            continue;
+
+        print_job(job);
+        if(job->running == 0)
+            job_remove(&sh->jobs, job);
+    }
+
+    sh->exit_status = 0;
+}
+
+// Accepts %n for a job number or a plain PID, which stands for the job that process belongs to.
+static Job* find_job(const char* operand, const char* builtin) {
+    Job* job = NULL;
+    if(operand[0] == '%') {
+        job = job_find(&sh->jobs, atoi(operand + 1));
+    } else {
+        JobProcess* process = job_find_process(&sh->jobs, atoi(operand));
+        job = process != NULL ? process->job : NULL;
+    }
+
+    if(job == NULL)
+        fprintf(stderr, "%s: %s: no such job\n", builtin, operand);
+
+    return job;
+}
+
+// There is no terminal job control, so bringing a job to the foreground means waiting for it.
+void fg_handler() {
+    Job* job = NULL;
+    if(sh->token_count > 1)
+        job = find_job(sh->tokens[1], "fg");
+    else if(sh->jobs.count > 0)
+        job = sh->jobs.slots[sh->jobs.count - 1];
+    else
+        fprintf(stderr, "fg: no current job\n");
+
+    if(job == NULL) {
+        sh->exit_status = 1;
+        return;
     }
 
-    fprintf(sh->output_stream, "Variable '%s' wasn't set\n", name);
-    sh->exit_status = 1;
+    fprintf(sh->output_stream, "%s\n", job->command);
+    output_flush(&sh->output);
+    sh->exit_status = job_wait(&sh->jobs, job);
+    job_remove(&sh->jobs, job);
 }
 
-void setvar_handler() {
-    if(sh->token_count < 2) {
-        fprintf(sh->output_stream, "Usage: setvar 'varname'='value'\n");
-        sh->exit_status = 1;
+void wait_handler() {
+    output_flush(&sh->output);
+    sh->exit_status = 0;
+    if(sh->token_count == 1) {
+        while(sh->jobs.running > 0 && job_table_poll(&sh->jobs, -1) >= 0);
         return;
     }
 
-    char* equals_sign = strchr(sh->tokens[1], '=');
-    const char* name;
-    const char* value;
-    if (equals_sign != NULL) {
-        *equals_sign = '\0';
-        name = sh->tokens[1];
-        value = equals_sign + 1;
+    for(int t = 1; t < sh->token_count; ++t) {
+        Job* job = find_job(sh->tokens[t], "wait");
+        if(job == NULL) {
+            sh->exit_status = 127;
+            continue;
+        }
+
+        sh->exit_status = job_wait(&sh->jobs, job);
+        job_remove(&sh->jobs, job);
     }
+}
 
-    for (int i = 0; i < sh->variable_count; ++i) {
-        if (strcmp(sh->variables[i].name, name) == 0) {
-            free(sh->variables[i].value);
-            sh->variables[i].value = strdup(value);
-            sh->exit_status = 0;
-            return;
+typedef struct {
+    Job* job;
+    int output_fd;
+    int status;
+    _Bool done;
+} ParallelTask;
+
+// The inputs after ::: are copied out of the line arena, since builtins run by parallel reuse it.
+static char* read_parallel_inputs(int first, char*** inputs, int* count) {
+    size_t size = 0;
+    size_t capacity = SCRIPT_READ_BLOCK_SIZE;
+    char* data = malloc(capacity);
+    if(first < sh->token_count) {
+        for(int t = first; t < sh->token_count; ++t) {
+            size_t length = strlen(sh->tokens[t]) + 1;
+            if(size + length > capacity) {
+                capacity = (size + length) * 2;
+                data = realloc(data, capacity);
+            }
+
+            memcpy(data + size, sh->tokens[t], length);
+            size += length;
+        }
+    } else {
+        // Straight from the descriptor, since the input stream may have buffered lines of a script.
+        ssize_t bytes_read;
+        while((bytes_read = read(STDIN_FILENO, data + size, capacity - size - 1)) > 0) {
+            size += bytes_read;
+            if(size + 1 == capacity) {
+                capacity *= 2;
+                data = realloc(data, capacity);
+            }
         }
-    }
 
-    if (sh->variable_count >= MAX_VARIABLES) {
-        fprintf(sh->output_stream, "Maximum number of variables (32) reached. User 'free varname' to make space for new variables.\n");
-        sh->exit_status = 1;
-        return;
+        for(size_t i = 0; i < size; ++i)
+            if(data[i] == '\n')
+                data[i] = '\0';
+
+        if(size > 0 && data[size - 1] != '\0')
+            data[size++] = '\0';
     }
 
-    sh->variables[sh->variable_count].name = strdup(name);
-    sh->variables[sh->variable_count].value = strdup(value);
-    ++sh->variable_count;
-    sh->exit_status = 0;
-}
+    *count = 0;
+    *inputs = malloc((size / 2 + 1) * sizeof(char*));
+    for(size_t offset = 0; offset < size; offset += strlen(data + offset) + 1)
+        if(first < sh->token_count || data[offset] != '\0')
+            (*inputs)[(*count)++] = data + offset;
 
-void colorlist_handler() {
-    fprintf(sh->output_stream, "Available colors:\n");
-    for(int c = 0; c < NUM_COLORS; ++c)
-        fprintf(sh->output_stream, "%s\n", colors[c].name);
+    return data;
 }
 
-void resetcolor_handler() {
-    if(sh->color != NULL)
-        free(sh->color);
+// Every {} in the words of the command is replaced by the input; without one the input is appended. The
+// substituted words are built in one allocation, which the caller frees.
+static char* build_parallel_command(CachedCommand* command, const char* input, char** argv, int* count) {
+    size_t input_length = strlen(input);
+    size_t size = 0;
+    for(int t = 0; t < command->token_count; ++t)
+        for(char* s = strstr(command->text + command->offsets[t], "{}"); s != NULL; s = strstr(s + 2, "{}"))
+            size += input_length;
+
+    char* words = malloc(command->text_length + size);
+    char* next = words;
+    _Bool substituted = 0;
+    for(int t = 0; t < command->token_count; ++t) {
+        char* word = command->text + command->offsets[t];
+        char* marker = strstr(word, "{}");
+        argv[t] = word;
+        if(marker == NULL)
+            continue;
 
-    sh->color_active = 0;
-    sh->exit_status = 0;
-}
+        argv[t] = next;
+        for(; marker != NULL; marker = strstr(word, "{}")) {
+            memcpy(next, word, marker - word);
+            next += marker - word;
+            memcpy(next, input, input_length);
+            next += input_length;
+            word = marker + 2;
+        }
 
-void setcolor_handler() {
-    if(sh->token_count < 2) {
-        fprintf(sh->output_stream, "Usage: setcolor 'color'\n");
-        sh->exit_status = 1;
-        return;
+        next = stpcpy(next, word) + 1;
+        substituted = 1;
     }
 
-    char* color_code = find_color(sh->tokens[1]);
-    if(color_code == NULL) {
-        fprintf(sh->output_stream, "Invalid color. Try 'colorlist'.\n");
-        sh->exit_status = 1;
-        return;
-    }
+    *count = command->token_count;
+    if(!substituted)
+        argv[(*count)++] = (char*) input;
 
-    if(sh->color != NULL)
-        free(sh->color);
+    argv[*count] = NULL;
+    return words;
+}
 
-    sh->color = strdup(color_code);
-    sh->color_active = 1;
-    sh->exit_status = 0;
+static void finish_parallel_task(ParallelTask* task, JobTable* table) {
+    task->status = task->job->status;
+    task->done = 1;
+    job_remove(table, task->job);
+    task->job = NULL;
 }
 
-void alias_handler() {
-    if(sh->token_count < 3) {
-        fprintf(sh->output_stream, "Usage: alias 'command name' 'alias name'\n");
-        sh->exit_status = 1;
-        return;
-    }
+// With ordered output every task writes into its own memory file, which is copied out once all the tasks
+// before it have been.
+static void emit_parallel_output(ParallelTask* tasks, int count, int* next) {
+    for(; *next < count && tasks[*next].done; ++*next) {
+        if(tasks[*next].output_fd == -1)
+            continue;
 
-    if(sh->alias_count >= MAX_ALIASES) {
-        fprintf(sh->output_stream, "Alias limit reached\n");
-        sh->exit_status = 1;
-        return;
+        lseek(tasks[*next].output_fd, 0, SEEK_SET);
+        copy_data(tasks[*next].output_fd, STDOUT_FILENO);
+        close(tasks[*next].output_fd);
+        tasks[*next].output_fd = -1;
     }
+}
 
-    char* command = sh->tokens[1];
-    char* name = sh->tokens[2];
-    if(find_builtin(name) != NULL) {
-        fprintf(sh->output_stream, "Alias name cannot be another built-in command\n");
-        sh->exit_status = 1;
-        return;
+// Keeps up to N commands running, starting the next one whenever one exits. The exit status is the number of
+// commands that failed, capped at 101 like GNU parallel. Builtins run in the shell, one after another.
+void parallel_handler() {
+    long limit = sysconf(_SC_NPROCESSORS_ONLN);
+    _Bool keep_order = 0;
+    int t = 1;
+    for(; t < sh->token_count && sh->tokens[t][0] == '-'; ++t) {
+        if(strcmp(sh->tokens[t], "-k") == 0)
+            keep_order = 1;
+        else if(strcmp(sh->tokens[t], "-j") == 0 && t + 1 < sh->token_count)
+            limit = atol(sh->tokens[++t]);
+        else if(strncmp(sh->tokens[t], "-j", 2) == 0 && sh->tokens[t][2] != '\0')
+            limit = atol(sh->tokens[t] + 2);
+        else
+            break;
     }
 
-    sh->aliases[sh->alias_count].command = strdup(command);
-    sh->aliases[sh->alias_count].alias = strdup(name);
-    sh->alias_count++;
-    fprintf(sh->output_stream, "Alias '%s' added\n", name);
-    sh->exit_status = 0;
-}
+    int separator = t;
+    while(separator < sh->token_count && strcmp(sh->tokens[separator], ":::") != 0)
+        ++separator;
 
-void unalias_handler() {
-    if(sh->token_count < 2) {
-        fprintf(sh->output_stream, "Usage: unalias 'alias name'\n");
+    if(separator == t || limit < 1) {
+        fprintf(sh->output_stream, "Usage: parallel [-j N] [-k] command [args...] [::: inputs...]\n");
         sh->exit_status = 1;
         return;
     }
 
-    char* name = sh->tokens[1];
-    for(int i = 0; i < sh->alias_count; ++i) {
-        if(strcmp(sh->aliases[i].alias, name) == 0) {
-            free(sh->aliases[i].alias);
-            free(sh->aliases[i].command);
-            sh->aliases[i] = sh->aliases[sh->alias_count - 1];
-            sh->alias_count--;
-            fprintf(sh->output_stream, "Alias '%s' removed\n", name);
-            sh->exit_status = 0;
-            return;
+    CachedCommand* command = command_create("", 0, &sh->tokens[t], &sh->token_kinds[t], separator - t,
+                                            find_builtin(sh->tokens[t]), 0);
+    char** inputs;
+    int input_count;
+    char* input_data = read_parallel_inputs(separator < sh->token_count ? separator + 1 : sh->token_count,
+                                            &inputs, &input_count);
+    char* argv[command->token_count + 2];
+    unsigned char kinds[command->token_count + 1];
+    memset(kinds, TOKEN_WORD, sizeof(kinds));
+    ParallelTask* tasks = calloc(input_count, sizeof(ParallelTask));
+    _Bool input_redirected = sh->is_input_redirected;
+    _Bool output_redirected = sh->is_output_redirected;
+    sh->is_input_redirected = 0;
+    sh->is_output_redirected = 0;
+    sh->background = 0;
+    output_flush(&sh->output);
+
+    JobTable table;
+    job_table_init(&table);
+    int* running = malloc((limit < input_count ? limit : input_count + 1) * sizeof(int));
+    int running_count = 0;
+    int next_output = 0;
+    for(int i = 0; i < input_count || running_count > 0;) {
+        if(i < input_count && command->function != NULL) {
+            int count;
+            char* words = build_parallel_command(command, inputs[i], argv, &count);
+            CachedCommand* invocation = command_create("", 0, argv, kinds, count, command->function, 0);
+            free(words);
+            restore_command(invocation);
+            execute_builtin(invocation->function);
+            output_flush(&sh->output);
+            free(invocation);
+            tasks[i].status = sh->exit_status;
+            tasks[i].output_fd = -1;
+            tasks[i++].done = 1;
+            continue;
+        }
+
+        if(i < input_count && running_count < limit) {
+            int count;
+            char* words = build_parallel_command(command, inputs[i], argv, &count);
+            tasks[i].output_fd = keep_order ? create_memory_file("parallel") : -1;
+            pid_t pid = spawn_command(argv, -1, tasks[i].output_fd);
+            if(pid == -1) {
+                tasks[i].status = sh->exit_status;
+                tasks[i].done = 1;
+            } else {
+                tasks[i].job = job_start(&table, argv[0], &pid, 1);
+                running[running_count++] = i;
+            }
+
+            free(words);
+            ++i;
+            continue;
+        }
+
+        job_table_poll(&table, -1);
+        for(int r = 0; r < running_count;) {
+            if(tasks[running[r]].job->running == 0) {
+                finish_parallel_task(&tasks[running[r]], &table);
+                running[r] = running[--running_count];
+            } else {
+                ++r;
+            }
         }
+
+        emit_parallel_output(tasks, input_count, &next_output);
     }
 
-    fprintf(sh->output_stream, "Alias not found\n");
-    sh->exit_status = 1;
+    emit_parallel_output(tasks, input_count, &next_output);
+    job_table_free(&table);
+    int failed = 0;
+    for(int i = 0; i < input_count; ++i)
+        failed += tasks[i].status != 0;
+
+    sh->is_input_redirected = input_redirected;
+    sh->is_output_redirected = output_redirected;
+    sh->exit_status = failed < 101 ? failed : 101;
+    free(running);
+    free(tasks);
+    free(inputs);
+    free(input_data);
+    free(command);
 }
 
-void aliaslist_handler() {
-    if(sh->alias_count == 0)
-        fprintf(sh->output_stream, "No active aliases\n");
+void pinfo_handler() {
+    ProcessList list;
+    process_list_init(&list);
+    if(scan_processes(sh->procfs_path, &list, 0, NULL) == -1) {
+        sh->exit_status = errno;
+        perror("pinfo");
+        return;
+    }
 
-    for(int i = 0; i < sh->alias_count; ++i)
-        fprintf(sh->output_stream, "alias %s='%s'\n", sh->aliases[i].alias, sh->aliases[i].command);
+    output_string(&sh->output, "  PID  PPID STANJE IME\n");
+    for(size_t i = 0; i < list.count; i++) {
+        output_long(&sh->output, list.processes[i].pid, 5);
+        output_char(&sh->output, ' ');
+        output_long(&sh->output, list.processes[i].ppid, 5);
+        output_spaces(&sh->output, 6);
+        output_char(&sh->output, list.processes[i].state);
+        output_char(&sh->output, ' ');
+        output_string(&sh->output, list.processes[i].name);
+        output_char(&sh->output, '\n');
+    }
 
+    process_list_free(&list);
     sh->exit_status = 0;
 }
 
-void history_handler() {
-    sh->exit_status = 0;
-    if(sh->history_count < 2) {
-        fprintf(sh->output_stream, "History is empty.\n");
-        return;
+static void print_sample(ProcessSample* sample, long page_kb) {
+    fprintf(sh->output_stream, "%7d %7d %c %5d.%d %10ld %+9ld %s", sample->info.pid, sample->info.ppid,
+            sample->info.state, sample->cpu_tenths / 10, sample->cpu_tenths % 10, sample->info.rss_pages * page_kb,
+            sample->rss_delta * page_kb, sample->info.name);
+}
+
+// On a terminal only the rows whose process or values changed are rewritten in place.
+static void draw_terminal_frame(ProcessSnapshot* snapshot, int* row_pids, int rows, int* rows_drawn, int frame,
+                                double interval, long page_kb) {
+    if(frame == 0)
+        fprintf(sh->output_stream, "\033[H\033[2J\033[2;1H%7s %7s %c %7s %10s %9s %s", "PID", "PPID", 'S', "CPU%",
+                "RSS KB", "DELTA KB", "NAME");
+
+    fprintf(sh->output_stream, "\033[1;1H\033[Kptop: %zu processes, %zu exited, every %.1fs, Enter to quit",
+            snapshot->count, snapshot->exited.count, interval);
+    int visible = snapshot->count < (size_t) rows ? (int) snapshot->count : rows;
+    for(int r = 0; r < visible; ++r) {
+        ProcessSample* sample = &snapshot->samples[r];
+        if(frame > 0 && r < *rows_drawn && row_pids[r] == sample->info.pid && !sample->changed)
+            continue;
+
+        fprintf(sh->output_stream, "\033[%d;1H\033[K", r + 3);
+        print_sample(sample, page_kb);
+        row_pids[r] = sample->info.pid;
     }
 
-    for(int i = 0; i < sh->history_count; ++i)
-        fprintf(sh->output_stream, "%d: %s\n", sh->history_count - i, sh->history[i]);
+    for(int r = visible; r < *rows_drawn; ++r)
+        fprintf(sh->output_stream, "\033[%d;1H\033[K", r + 3);
+
+    *rows_drawn = visible;
+    output_flush(&sh->output);
 }
 
-void nthcmd_handler() {
-    if(sh->token_count < 2) {
-        fprintf(sh->output_stream, "Not enough input arguments. See 'help'\n");
-        sh->exit_status = 1;
-        return;
-    }
+// Elsewhere the first frame lists every process and later ones only what changed.
+static void print_frame(ProcessSnapshot* snapshot, int frame, long page_kb) {
+    if(frame == 0) {
+        fprintf(sh->output_stream, "%7s %7s %c %7s %10s %9s %s\n", "PID", "PPID", 'S', "CPU%", "RSS KB", "DELTA KB",
+                "NAME");
+    } else {
+        size_t changed = 0;
+        for(size_t s = 0; s < snapshot->count; ++s)
+            changed += snapshot->samples[s].changed;
 
-    int n = atoi(sh->tokens[1]);
-    if(n > 32) {
-        fprintf(sh->output_stream, "Provided n is too high. Maximum value for n is %d\n", HISTORY_SIZE);
-        sh->exit_status = 1;
-        return;
+        fprintf(sh->output_stream, "-- refresh %d: %zu processes, %zu changed, %zu exited\n", frame, snapshot->count,
+                changed, snapshot->exited.count);
     }
 
-    if(n > sh->history_count) {
-        fprintf(sh->output_stream, "Command number %d does not exit. Currently only %d commands in history\n", n,
-                sh->history_count);
-        sh->exit_status = 1;
-        return;
+    for(size_t s = 0; s < snapshot->count; ++s) {
+        if(frame > 0 && !snapshot->samples[s].changed)
+            continue;
+
+        print_sample(&snapshot->samples[s], page_kb);
+        fputc('\n', sh->output_stream);
     }
 
-    sh->block_prompt = 1;
-    sh->history_index = sh->history_count - n;
-    char* nth_cmd = sh->history[sh->history_index];
-    fprintf(sh->output_stream, "%s>%s", sh->prompt_text, nth_cmd);
-    sh->exit_status = 0;
+    for(size_t e = 0; e < snapshot->exited.count; ++e)
+        fprintf(sh->output_stream, "%7d exited\n", snapshot->exited.pids[e]);
+
+    output_flush(&sh->output);
 }
 
-void lastcmd_handler() {
-    if(sh->history_count < 1) {
-        fprintf(sh->output_stream, "History empty\n");
-        sh->exit_status = 1;
-        return;
+static _Bool wait_for_quit(double interval) {
+    if(isatty(STDIN_FILENO)) {
+        struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+        if(poll(&input, 1, (int) (interval * 1000)) <= 0)
+            return 0;
+
+        char discard[BUFFER_SIZE];
+        read(STDIN_FILENO, discard, sizeof(discard));
+        return 1;
     }
 
-    sh->block_prompt = 1;
-    sh->history_index = sh->history_count - 1;
-    fprintf(sh->output_stream, "%s>%s", sh->prompt_text, sh->history[sh->history_index]);
-    sh->exit_status = 0;
+    struct timespec delay = {(time_t) interval, (long) ((interval - (time_t) interval) * 1e9)};
+    nanosleep(&delay, NULL);
+    return 0;
 }
 
-void pipes_handler() {
-    if(sh->token_count < 3) {
-        fprintf(stderr, "pipes: at least two stages required\n");
+void ptop_handler() {
+    double interval = PTOP_DEFAULT_INTERVAL;
+    _Bool terminal = isatty(sh->output.fd);
+    int count = terminal ? 0 : 1;
+    for(int t = 1; t < sh->token_count; ++t) {
+        if(strcmp(sh->tokens[t], "-n") == 0 && t + 1 < sh->token_count)
+            count = atoi(sh->tokens[++t]);
+        else
+            interval = strtod(sh->tokens[t], NULL);
+    }
+
+    if(interval <= 0 || count < 0) {
+        fprintf(sh->output_stream, "Usage: ptop [interval] [-n count]\n");
         sh->exit_status = 1;
         return;
     }
 
-    int num_commands = sh->token_count - 1;
-    int pipe_fds[num_commands - 1][2];
-    pid_t pids[num_commands];
-    for(int i = 0; i < num_commands - 1; ++i) {
-        if(pipe(pipe_fds[i]) == -1) {
-            perror("pipe");
+    ProcessSnapshot snapshot;
+    process_snapshot_init(&snapshot);
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    struct winsize window;
+    int rows = terminal && ioctl(sh->output.fd, TIOCGWINSZ, &window) == 0 && window.ws_row > 3
+               ? window.ws_row - 3 : 20;
+    int* row_pids = malloc(rows * sizeof(int));
+    int rows_drawn = 0;
+    sh->exit_status = 0;
+    for(int frame = 0; count == 0 || frame < count; ++frame) {
+        if(frame > 0 && wait_for_quit(interval))
+            break;
+
+        if(process_snapshot_refresh(&snapshot, sh->procfs_path) == -1) {
             sh->exit_status = errno;
-            return;
+            perror("ptop");
+            break;
         }
+
+        if(terminal)
+            draw_terminal_frame(&snapshot, row_pids, rows, &rows_drawn, frame, interval, page_kb);
+        else
+            print_frame(&snapshot, frame, page_kb);
     }
 
-    for(int i = 0; i < num_commands; ++i) {
-        pids[i] = fork();
-        if(pids[i] == -1) {
-            perror("fork");
-            sh->exit_status = errno;
-            return;
-        }
+    if(terminal)
+        fprintf(sh->output_stream, "\033[%d;1H\n", rows_drawn + 3);
 
-        if(pids[i] == 0) {
-            if(i > 0)
-                dup2(pipe_fds[i - 1][0], STDIN_FILENO);
+    free(row_pids);
+    process_snapshot_free(&snapshot);
+}
 
-            if(i < num_commands - 1)
-                dup2(pipe_fds[i][1], STDOUT_FILENO);
+static const struct {
+    char* name;
+    int number;
+} signal_names[] = {
+        {"HUP",  SIGHUP},
+        {"INT",  SIGINT},
+        {"QUIT", SIGQUIT},
+        {"KILL", SIGKILL},
+        {"USR1", SIGUSR1},
+        {"USR2", SIGUSR2},
+        {"TERM", SIGTERM},
+        {"CONT", SIGCONT},
+        {"STOP", SIGSTOP},
+};
 
-            for(int j = 0; j < num_commands - 1; ++j) {
-                close(pipe_fds[j][0]);
-                close(pipe_fds[j][1]);
-            }
+static int parse_signal(char* name) {
+    if(isdigit((unsigned char) name[0]))
+        return atoi(name);
 
-            tokenize(sh->tokens[i + 1]);
-            FunctionPointer function = find_builtin(sh->tokens[0]);
-            if(function == NULL) {
-                execvp(sh->tokens[0], sh->tokens);
-                perror("execvp");
-                _exit(127);
-            } else {
-                function();
-                fflush(sh->output_stream);
-                _exit(sh->exit_status);
-            }
-        }
-    }
+    if(strncmp(name, "SIG", 3) == 0)
+        name += 3;
 
-    for(int i = 0; i < num_commands - 1; ++i) {
-        close(pipe_fds[i][0]);
-        close(pipe_fds[i][1]);
-    }
+    for(size_t s = 0; s < sizeof(signal_names) / sizeof(signal_names[0]); ++s)
+        if(strcmp(signal_names[s].name, name) == 0)
+            return signal_names[s].number;
 
-    for(int i = 0; i < num_commands; ++i) {
-        int status;
-        waitpid(pids[i], &status, 0);
-        if(WIFEXITED(status)) {
-            sh->exit_status = WEXITSTATUS(status);
+    return 0;
+}
+
+// Parses "[pattern] [-s state] [-p ppid] [-u uid|user] [-t]" from the given token on. Returns the number of
+// filters set, or -1 on a malformed argument.
+static int parse_process_filter(int first, ProcessFilter* filter, _Bool* tree) {
+    int filters = 0;
+    *filter = (ProcessFilter) {NULL, '\0', -1, -1};
+    *tree = 0;
+    for(int t = first; t < sh->token_count; ++t) {
+        char* option = sh->tokens[t];
+        if(strcmp(option, "-t") == 0) {
+            *tree = 1;
+            continue;
+        }
+
+        if(option[0] != '-') {
+            filter->name_pattern = option;
+        } else if(t + 1 == sh->token_count) {
+            return -1;
+        } else if(strcmp(option, "-s") == 0) {
+            filter->state = sh->tokens[++t][0];
+        } else if(strcmp(option, "-p") == 0) {
+            filter->ppid = atoi(sh->tokens[++t]);
+        } else if(strcmp(option, "-u") == 0) {
+            char* user = sh->tokens[++t];
+            struct passwd* entry = isdigit((unsigned char) user[0]) ? NULL : getpwnam(user);
+            filter->uid = entry != NULL ? (long) entry->pw_uid : isdigit((unsigned char) user[0]) ? atol(user) : -2;
         } else {
-            sh->exit_status = 1;
+            return -1;
         }
+
+        ++filters;
     }
+
+    return filters;
 }
 
-void waitall_handler() {
-    int status;
-    while(waitpid(WAIT_ANY, &status, 0) > 0) {
-        if(WIFEXITED(status))
-            sh->exit_status = WEXITSTATUS(status);
-        else
-            sh->exit_status = 1;
+static void print_process_tree(ProcessList* list) {
+    int* first_child = malloc(list->count * sizeof(int));
+    int* next_sibling = malloc(list->count * sizeof(int));
+    int* stack = malloc((list->count + 1) * sizeof(int));
+    int* depths = malloc((list->count + 1) * sizeof(int));
+    int top = 0;
+    int root = index_children(list, first_child, next_sibling);
+    if(root != -1) {
+        stack[top] = root;
+        depths[top++] = 0;
+    }
+
+    while(top > 0) {
+        int p = stack[--top];
+        int depth = depths[top];
+        if(next_sibling[p] != -1) {
+            stack[top] = next_sibling[p];
+            depths[top++] = depth;
+        }
+
+        if(first_child[p] != -1) {
+            stack[top] = first_child[p];
+            depths[top++] = depth + 1;
+        }
+
+        fprintf(sh->output_stream, "%7d %*s%s%s\n", list->processes[p].pid, depth * 2, "", depth > 0 ? "\\_ " : "",
+                list->processes[p].name);
     }
+
+    free(first_child);
+    free(next_sibling);
+    free(stack);
+    free(depths);
 }
 
-void waitone_handler() {
-    pid_t pid_to_wait;
-    if(sh->token_count > 1)
-        pid_to_wait = atoi(sh->tokens[1]);
-    else
-        pid_to_wait = -1;
+void pfind_handler() {
+    ProcessFilter filter;
+    _Bool tree;
+    if(parse_process_filter(1, &filter, &tree) == -1) {
+        fprintf(sh->output_stream, "Usage: pfind [pattern] [-s state] [-p ppid] [-u uid] [-t]\n");
+        sh->exit_status = 1;
+        return;
+    }
 
-    int status;
-    int pid = waitpid(pid_to_wait, &status, 0);
-    if(pid == -1)
-        sh->exit_status = 0;
-    else {
-        if(WIFEXITED(status))
-            sh->exit_status = WEXITSTATUS(status);
-        else
-            sh->exit_status = 1;
+    ProcessList list;
+    process_list_init(&list);
+    if(scan_processes(sh->procfs_path, &list, 0, &filter) == -1) {
+        sh->exit_status = errno;
+        perror("pfind");
+        return;
+    }
+
+    if(tree) {
+        print_process_tree(&list);
+    } else {
+        for(size_t p = 0; p < list.count; ++p)
+            fprintf(sh->output_stream, "%7d %s\n", list.processes[p].pid, list.processes[p].name);
     }
+
+    sh->exit_status = list.count == 0;
+    process_list_free(&list);
 }
 
-void pinfo_handler() {
-    FILE* file;
-    char filename[MAX_LINE_LENGTH];
-    char line[MAX_LINE_LENGTH];
-    ProcessInfo processes[MAX_PROCESSES_COUNT];
-    int num_processes = 0;
+// At least one filter is required, and the shell itself is never signalled.
+void psignal_handler() {
+    int signal_number = SIGTERM;
+    int first = 1;
+    if(sh->token_count > 1 && sh->tokens[1][0] == '-' && !islower((unsigned char) sh->tokens[1][1])) {
+        signal_number = parse_signal(sh->tokens[1] + 1);
+        first = 2;
+    }
 
-    DIR* dir = opendir(sh->procfs_path);
-    if(dir == NULL) {
-        perror("opendir");
+    ProcessFilter filter;
+    _Bool tree;
+    if(signal_number <= 0 || parse_process_filter(first, &filter, &tree) < 1 || tree) {
+        fprintf(sh->output_stream, "Usage: psignal [-signal] [pattern] [-s state] [-p ppid] [-u uid]\n");
         sh->exit_status = 1;
         return;
     }
 
-    struct dirent* entry;
-    while((entry = readdir(dir)) != NULL) {
-        if(entry->d_type == DT_DIR && atoi(entry->d_name) != 0) {
-            int pid = atoi(entry->d_name);
-            snprintf(filename, sizeof(filename), "%s/%d/stat", sh->procfs_path, pid);
-            file = fopen(filename, "r");
-            if(file == NULL) {
-                perror("fopen");
-                continue;
-            }
+    ProcessList list;
+    process_list_init(&list);
+    if(scan_processes(sh->procfs_path, &list, 0, &filter) == -1) {
+        sh->exit_status = errno;
+        perror("psignal");
+        return;
+    }
 
-            if(fgets(line, sizeof(line), file) != NULL) {
-                sscanf(line, "%d %s %c %d", &processes[num_processes].pid, processes[num_processes].name,
-                       &processes[num_processes].state, &processes[num_processes].ppid);
-                strcpy(processes[num_processes].name, remove_brackets(processes[num_processes].name));
-                num_processes++;
-            }
+    size_t signalled = 0;
+    sh->exit_status = 1;
+    for(size_t p = 0; p < list.count; ++p) {
+        if(list.processes[p].pid == getpid())
+            continue;
 
-            fclose(file);
+        if(kill(list.processes[p].pid, signal_number) == -1) {
+            fprintf(stderr, "psignal: %d: %s\n", list.processes[p].pid, strerror(errno));
+            continue;
         }
-    }
 
-    closedir(dir);
-    qsort(processes, num_processes, sizeof(ProcessInfo), compare_process_info);
-    fprintf(sh->output_stream, "%5s %5s %6s %s\n", "PID", "PPID", "STANJE", "IME");
-    for(int i = 0; i < num_processes; i++) {
-        fprintf(sh->output_stream, "%5d %5d %6c %s\n", processes[i].pid, processes[i].ppid, processes[i].state,
-                processes[i].name);
+        ++signalled;
+        sh->exit_status = 0;
     }
 
-    sh->exit_status = 0;
+    if(sh->debug_level)
+        fprintf(sh->output_stream, "Signal %d sent to %zu processes\n", signal_number, signalled);
+
+    process_list_free(&list);
 }
 
 void pids_handler() {
-    DIR* dir = opendir(sh->procfs_path);
-    if(dir == NULL) {
+    PidList list = {NULL, 0, 0};
+    if(list_pids(sh->procfs_path, &list) == -1) {
         sh->exit_status = errno;
         perror("pids");
         return;
     }
 
-    int pids[MAX_PROCESSES_COUNT];
-    int pids_count = 0;
-    struct dirent* entry;
-    while((entry = readdir(dir)) != NULL)
-        if(entry->d_type == DT_DIR && atoi(entry->d_name) != 0)
-            pids[pids_count++] = atoi(entry->d_name);
-
-    closedir(dir);
-    qsort(pids, pids_count, sizeof(int), compare_int);
-    for(int p = 0; p < pids_count; ++p)
-        fprintf(sh->output_stream, "%d\n", pids[p]);
+    for(size_t p = 0; p < list.count; ++p) {
+        output_long(&sh->output, list.pids[p], 0);
+        output_char(&sh->output, '\n');
+    }
 
-    fflush(sh->output_stream);
+    free(list.pids);
     sh->exit_status = 0;
 }
 
@@ -844,6 +2208,24 @@ void pid_handler() {
 }
 
 void cpcat_handler() {
+    if(sh->token_count >= 2 && strcmp(sh->tokens[1], "-m") == 0) {
+        struct stat target_stat;
+        if(sh->token_count < 4) {
+            fprintf(sh->output_stream, "Usage: cpcat -m 'source'... 'directory'\n");
+            sh->exit_status = 1;
+        } else if(stat(sh->tokens[sh->token_count - 1], &target_stat) == -1) {
+            sh->exit_status = errno;
+            perror("cpcat");
+        } else if(!S_ISDIR(target_stat.st_mode)) {
+            sh->exit_status = ENOTDIR;
+            fprintf(stderr, "cpcat: %s: %s\n", sh->tokens[sh->token_count - 1], strerror(ENOTDIR));
+        } else {
+            sh->exit_status = copy_files(&sh->tokens[2], sh->token_count - 3, sh->tokens[sh->token_count - 1]);
+        }
+
+        return;
+    }
+
     int input_file_desc = STDIN_FILENO;
     int output_file_desc = STDOUT_FILENO;
     if(sh->token_count >= 2 && sh->tokens[1][0] != '-') {
@@ -864,10 +2246,12 @@ void cpcat_handler() {
         }
     }
 
-    copy_data(input_file_desc, output_file_desc);
+    if(output_file_desc == STDOUT_FILENO)
+        output_flush(&sh->output);
+
+    sh->exit_status = copy_data(input_file_desc, output_file_desc) == -1 ? errno : 0;
     close_file(input_file_desc);
     close_file(output_file_desc);
-    sh->exit_status = 0;
 }
 
 void linklist_handler() {
@@ -1025,13 +2409,13 @@ void dirls_handler() {
     _Bool first_entry = 1;
     while((dir_entry = readdir(dir)) != NULL) {
         if(!first_entry)
-            fprintf(sh->output_stream, "  ");
+            output_write(&sh->output, "  ", 2);
 
         first_entry = 0;
-        fprintf(sh->output_stream, "%s", dir_entry->d_name);
+        output_string(&sh->output, dir_entry->d_name);
     }
 
-    fputc('\n', sh->output_stream);
+    output_char(&sh->output, '\n');
     closedir(dir);
     sh->exit_status = 0;
 }
@@ -1193,6 +2577,57 @@ void status_handler() {
     fprintf(sh->output_stream, "%d\n", sh->exit_status);
 }
 
+// The report goes to stderr, so it stays apart from the output of the command, which may be redirected.
+void time_handler() {
+    ResourceUsage usage;
+    if(sh->token_count == 1) {
+        begin_usage(&usage);
+        report_usage(&usage, stderr, "");
+        sh->exit_status = 0;
+        return;
+    }
+
+    memmove(sh->tokens, &sh->tokens[1], sh->token_count * sizeof(char*));
+    memmove(sh->token_kinds, &sh->token_kinds[1], --sh->token_count);
+    if(strcmp(sh->tokens[0], "unalias"))
+        map_aliases();
+
+    // Any redirects already apply to this builtin, and through it to the timed command.
+    _Bool input_redirected = sh->is_input_redirected;
+    _Bool output_redirected = sh->is_output_redirected;
+    sh->is_input_redirected = 0;
+    sh->is_output_redirected = 0;
+    sh->background = 0;
+    begin_usage(&usage);
+    FunctionPointer function = find_builtin(sh->tokens[0]);
+    if(function == NULL)
+        execute_external();
+    else
+        execute_builtin(function);
+
+    report_usage(&usage, stderr, "");
+    sh->is_input_redirected = input_redirected;
+    sh->is_output_redirected = output_redirected;
+}
+
+void stats_handler() {
+    sh->exit_status = 0;
+    if(sh->token_count == 1) {
+        stats_print(sh->output_stream);
+    } else if(strcmp(sh->tokens[1], "on") == 0) {
+        stats_enabled = 1;
+    } else if(strcmp(sh->tokens[1], "off") == 0) {
+        stats_enabled = 0;
+    } else if(strcmp(sh->tokens[1], "-r") == 0) {
+        stats_reset();
+    } else if(strcmp(sh->tokens[1], "-j") == 0) {
+        stats_print_json(sh->output_stream);
+    } else {
+        fprintf(sh->output_stream, "Usage: stats [on|off|-r|-j]\n");
+        sh->exit_status = 1;
+    }
+}
+
 void debug_handler() {
     if(sh->token_count == 1) {
         fprintf(sh->output_stream, "%d\n", sh->debug_level);
@@ -1223,12 +2658,17 @@ void exit_handler() {
     if(sh->token_count > 1)
         sh->exit_status = atoi(sh->tokens[1]);
 
+    output_flush(&sh->output);
     exit(sh->exit_status);
 }
 
 void help_handler() {
-    for(int c = 0; c < NUM_COMMANDS; ++c)
-        fprintf(sh->output_stream, "%s: %s\n", commands[c].name, commands[c].help_text);
+    for(int c = 0; c < NUM_COMMANDS; ++c) {
+        output_string(&sh->output, commands[c].name);
+        output_write(&sh->output, ": ", 2);
+        output_string(&sh->output, commands[c].help_text);
+        output_char(&sh->output, '\n');
+    }
 
     sh->exit_status = 0;
 }
\ No newline at end of file
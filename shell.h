@@ -14,8 +14,15 @@
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <time.h>
+#include <pwd.h>
+#include <sys/resource.h>
 
 Shell* start_shell();
 void stop_shell();
@@ -25,11 +32,14 @@ char* find_color(char* color_name);
 char* get_value(char* varname);
 void print_tokens();
 void handle_redirects();
-void expand_variables(char* buffer);
 void tokenize(char* buffer);
 void map_aliases();
 void execute_external();
 void execute_builtin(FunctionPointer function);
+void execute_line(char* line);
+void notify_jobs();
+void run_script(char* path);
+void repl(_Bool interactive);
 
 void status_handler();
 void exit_handler();
@@ -65,13 +75,25 @@ void egid_handler();
 void sysinfo_handler();
 void proc_handler();
 void pids_handler();
+void ptop_handler();
+void pfind_handler();
+void psignal_handler();
 void pinfo_handler();
 void waitone_handler();
 void waitall_handler();
+void jobs_handler();
+void fg_handler();
+void wait_handler();
+void parallel_handler();
+void time_handler();
+void stats_handler();
 void pipes_handler();
+void pipesize_handler();
 void lastcmd_handler();
 void nthcmd_handler();
 void history_handler();
+void hsearch_handler();
+void source_handler();
 void alias_handler();
 void unalias_handler();
 void aliaslist_handler();
@@ -81,6 +103,15 @@ void colorlist_handler();
 void setvar_handler();
 void freevar_handler();
 void varlist_handler();
+void hash_handler();
+void cmdcache_handler();
+
+enum {
+#define BUILTIN(name, function, help_text) BUILTIN_##function,
+#include "builtins.def"
+#undef BUILTIN
+    NUM_COMMANDS
+};
 
 extern const Color colors[NUM_COLORS];
 extern const Command commands[NUM_COMMANDS];
@@ -0,0 +1,38 @@
+#include "spawner.h"
+
+#include <spawn.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+
+extern char** environ;
+
+// glibc implements posix_spawn with clone(CLONE_VM | CLONE_VFORK), so the child shares the shell's
+// address space until exec instead of copying its page tables like fork() does.
+pid_t spawn_process(char* path, char** argv, int input_fd, int output_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if(input_fd != -1 && input_fd != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+
+    if(output_fd != -1 && output_fd != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &empty_mask);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, path, &actions, &attributes, argv, environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    if(error != 0) {
+        errno = error;
+        return -1;
+    }
+
+    return pid;
+}
@@ -0,0 +1,8 @@
+#ifndef MYSHELL_SPAWNER_H
+#define MYSHELL_SPAWNER_H
+
+#include <sys/types.h>
+
+pid_t spawn_process(char* path, char** argv, int input_fd, int output_fd);
+
+#endif //MYSHELL_SPAWNER_H
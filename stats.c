@@ -0,0 +1,87 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+_Bool stats_enabled = 0;
+
+static const char* probe_names[STAT_COUNT] = {
+        [STAT_TOKENIZE] = "tokenize",
+        [STAT_EXPAND] = "expand_variable",
+        [STAT_MAP_ALIASES] = "map_aliases",
+        [STAT_FIND_BUILTIN] = "find_builtin",
+        [STAT_SPAWN] = "spawn",
+        [STAT_REDIRECT] = "redirect",
+};
+
+static StatProbe probes[STAT_COUNT];
+
+// Bucket b holds durations in [2^b, 2^(b+1)) nanoseconds, and bucket 0 also holds zero.
+void stats_record(int probe, uint64_t start) {
+    uint64_t elapsed = stats_now() - start;
+    StatProbe* stat = &probes[probe];
+    if(stat->count == 0 || elapsed < stat->min)
+        stat->min = elapsed;
+
+    if(elapsed > stat->max)
+        stat->max = elapsed;
+
+    ++stat->count;
+    stat->total += elapsed;
+    ++stat->buckets[elapsed == 0 ? 0 : 63 - __builtin_clzll(elapsed)];
+}
+
+void stats_reset() {
+    memset(probes, 0, sizeof(probes));
+}
+
+// The upper bound of the bucket the percentile falls in, or the maximum if that is lower, so it overestimates
+// by less than a factor of two.
+static uint64_t percentile(StatProbe* stat, double fraction) {
+    uint64_t rank = (uint64_t) (stat->count * fraction);
+    uint64_t seen = 0;
+    for(int b = 0; b < STATS_BUCKETS; ++b) {
+        seen += stat->buckets[b];
+        if(seen > rank)
+            return b == STATS_BUCKETS - 1 || (uint64_t) 2 << b > stat->max ? stat->max : (uint64_t) 2 << b;
+    }
+
+    return stat->max;
+}
+
+void stats_print(FILE* stream) {
+    fprintf(stream, "%-16s %10s %12s %10s %10s %10s %10s %10s\n", "probe", "count", "total us", "mean ns", "min ns",
+            "p50 ns", "p99 ns", "max ns");
+    for(int p = 0; p < STAT_COUNT; ++p) {
+        StatProbe* stat = &probes[p];
+        fprintf(stream, "%-16s %10" PRIu64 " %12.1f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10"
+                PRIu64 "\n", probe_names[p], stat->count, stat->total / 1e3,
+                stat->count ? stat->total / stat->count : 0, stat->min, percentile(stat, 0.5), percentile(stat, 0.99),
+                stat->max);
+    }
+}
+
+// Only non-empty buckets are listed, keyed by their lower bound in nanoseconds.
+void stats_print_json(FILE* stream) {
+    fprintf(stream, "{\"enabled\": %s, \"unit\": \"ns\", \"probes\": {", stats_enabled ? "true" : "false");
+    for(int p = 0; p < STAT_COUNT; ++p) {
+        StatProbe* stat = &probes[p];
+        fprintf(stream, "%s\"%s\": {\"count\": %" PRIu64 ", \"total\": %" PRIu64 ", \"min\": %" PRIu64
+                ", \"max\": %" PRIu64 ", \"histogram\": {",
+                p ? ", " : "", probe_names[p], stat->count, stat->total, stat->min, stat->max);
+        _Bool first = 1;
+        for(int b = 0; b < STATS_BUCKETS; ++b) {
+            if(stat->buckets[b] == 0)
+                continue;
+
+            fprintf(stream, "%s\"%" PRIu64 "\": %" PRIu64, first ? "" : ", ", b ? (uint64_t) 1 << b : 0,
+                    stat->buckets[b]);
+            first = 0;
+        }
+
+        fprintf(stream, "}}");
+    }
+
+    fprintf(stream, "}}\n");
+}
@@ -0,0 +1,45 @@
+#ifndef MYSHELL_STATS_H
+#define MYSHELL_STATS_H
+
+#include "typedefs.h"
+
+#include <stdint.h>
+#include <time.h>
+
+enum {
+    STAT_TOKENIZE,
+    STAT_EXPAND,
+    STAT_MAP_ALIASES,
+    STAT_FIND_BUILTIN,
+    STAT_SPAWN,
+    STAT_REDIRECT,
+    STAT_COUNT,
+};
+
+extern _Bool stats_enabled;
+
+void stats_record(int probe, uint64_t start);
+void stats_reset();
+void stats_print(FILE* stream);
+void stats_print_json(FILE* stream);
+
+static inline uint64_t stats_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Times the statement when statistics are on. When they are off this is a single branch that is predicted
+// not taken, and the statement runs as it is.
+#define STATS_PROBE(probe, statement)                  \
+    do {                                               \
+        if(__builtin_expect(stats_enabled, 0)) {       \
+            uint64_t stats_start = stats_now();        \
+            statement;                                 \
+            stats_record(probe, stats_start);          \
+        } else {                                       \
+            statement;                                 \
+        }                                              \
+    } while(0)
+
+#endif //MYSHELL_STATS_H
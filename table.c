@@ -0,0 +1,121 @@
+#include "table.h"
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static TableEntry* probe(TableEntry* entries, size_t capacity, const char* key, size_t length, uint32_t hash) {
+    size_t mask = capacity - 1;
+    for(size_t i = hash & mask;; i = (i + 1) & mask) {
+        TableEntry* entry = &entries[i];
+        if(entry->key == NULL)
+            return entry;
+
+        if(entry->hash == hash && strncmp(entry->key, key, length) == 0 && entry->key[length] == '\0')
+            return entry;
+    }
+}
+
+// Keys of removed entries stay in the arena until they outweigh the live ones, then the live keys
+// are copied into a fresh arena.
+static void compact_keys(Table* table) {
+    Arena keys;
+    arena_init(&keys);
+    for(size_t i = 0; i < table->capacity; ++i) {
+        TableEntry* entry = &table->entries[i];
+        if(entry->key != NULL)
+            entry->key = arena_strndup(&keys, entry->key, strlen(entry->key));
+    }
+
+    arena_free(&table->keys);
+    table->keys = keys;
+    table->dead_key_bytes = 0;
+}
+
+static void grow(Table* table) {
+    size_t capacity = table->capacity * 2;
+    TableEntry* entries = calloc(capacity, sizeof(TableEntry));
+    for(size_t i = 0; i < table->capacity; ++i) {
+        TableEntry* entry = &table->entries[i];
+        if(entry->key == NULL)
+            continue;
+
+        size_t slot = entry->hash & (capacity - 1);
+        while(entries[slot].key != NULL)
+            slot = (slot + 1) & (capacity - 1);
+
+        entries[slot] = *entry;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    if(table->dead_key_bytes > 0)
+        compact_keys(table);
+}
+
+void table_init(Table* table) {
+    table->capacity = TABLE_INITIAL_CAPACITY;
+    table->count = 0;
+    table->entries = calloc(table->capacity, sizeof(TableEntry));
+    arena_init(&table->keys);
+    table->key_bytes = 0;
+    table->dead_key_bytes = 0;
+}
+
+void table_free(Table* table) {
+    table_clear(table);
+    free(table->entries);
+    table->entries = NULL;
+}
+
+void table_clear(Table* table) {
+    memset(table->entries, 0, table->capacity * sizeof(TableEntry));
+    arena_free(&table->keys);
+    table->count = 0;
+    table->key_bytes = 0;
+    table->dead_key_bytes = 0;
+}
+
+TableEntry* table_find(Table* table, const char* key, size_t length) {
+    TableEntry* entry = probe(table->entries, table->capacity, key, length, hash_bytes(key, length, 0));
+    return entry->key == NULL ? NULL : entry;
+}
+
+TableEntry* table_insert(Table* table, const char* key, size_t length) {
+    if((table->count + 1) * 4 > table->capacity * 3)
+        grow(table);
+
+    uint32_t hash = hash_bytes(key, length, 0);
+    TableEntry* entry = probe(table->entries, table->capacity, key, length, hash);
+    if(entry->key == NULL) {
+        entry->key = arena_strndup(&table->keys, key, length);
+        entry->hash = hash;
+        entry->value = NULL;
+        table->key_bytes += length + 1;
+        ++table->count;
+    }
+
+    return entry;
+}
+
+void table_remove(Table* table, TableEntry* entry) {
+    size_t mask = table->capacity - 1;
+    size_t hole = entry - table->entries;
+    size_t key_size = strlen(entry->key) + 1;
+    for(size_t i = (hole + 1) & mask; table->entries[i].key != NULL; i = (i + 1) & mask) {
+        size_t home = table->entries[i].hash & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            table->entries[hole] = table->entries[i];
+            hole = i;
+        }
+    }
+
+    table->entries[hole].key = NULL;
+    table->entries[hole].value = NULL;
+    --table->count;
+    table->key_bytes -= key_size;
+    table->dead_key_bytes += key_size;
+    if(table->dead_key_bytes >= ARENA_BLOCK_SIZE && table->dead_key_bytes > table->key_bytes)
+        compact_keys(table);
+}
@@ -0,0 +1,29 @@
+#ifndef MYSHELL_TABLE_H
+#define MYSHELL_TABLE_H
+
+#include "typedefs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+static inline uint32_t hash_bytes(const char* data, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for(size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+void table_init(Table* table);
+void table_free(Table* table);
+void table_clear(Table* table);
+TableEntry* table_find(Table* table, const char* key, size_t length);
+TableEntry* table_insert(Table* table, const char* key, size_t length);
+void table_remove(Table* table, TableEntry* entry);
+
+#endif //MYSHELL_TABLE_H
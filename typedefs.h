@@ -3,22 +3,25 @@
 
 #include "constants.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 typedef void (* FunctionPointer)();
 
-typedef struct {
-    char* name;
-    char* value;
-} Variable;
-
 typedef struct {
     char* name;
     char* code;
 } Color;
 
 typedef struct {
-    char* alias;
     char* command;
+    char* text;
+    size_t text_length;
+    char** words;
+    unsigned char* kinds;
+    int word_count;
+    unsigned long expansion;
 } Alias;
 
 typedef struct {
@@ -27,20 +30,219 @@ typedef struct {
     char* help_text;
 } Command;
 
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+} Arena;
+
+typedef struct {
+    char* key;
+    uint32_t hash;
+    void* value;
+} TableEntry;
+
+typedef struct {
+    TableEntry* entries;
+    size_t capacity;
+    size_t count;
+    Arena keys;
+    size_t key_bytes;
+    size_t dead_key_bytes;
+} Table;
+
+typedef struct {
+    char* path;
+    unsigned long hits;
+} PathEntry;
+
+typedef struct {
+    char* name;
+    struct timespec mtime;
+} PathDirectory;
+
+typedef struct {
+    Table commands;
+    char* path;
+    PathDirectory* directories;
+    int directory_count;
+    struct timespec checked;
+    unsigned long hits;
+    unsigned long misses;
+} PathCache;
+
+typedef struct CachedCommand {
+    struct CachedCommand* newer;
+    struct CachedCommand* older;
+    FunctionPointer function;
+    uint64_t variables;
+    char* line;
+    size_t line_length;
+    char* text;
+    size_t text_length;
+    uint32_t* offsets;
+    unsigned char* kinds;
+    int token_count;
+} CachedCommand;
+
+typedef struct {
+    Table lines;
+    CachedCommand* newest;
+    CachedCommand* oldest;
+    int count;
+    int capacity;
+    unsigned long hits;
+    unsigned long misses;
+} CommandCache;
+
+typedef struct {
+    size_t offset;
+    size_t length;
+} HistoryEntry;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* serials;
+} Postings;
+
+typedef struct {
+    Postings* slots;
+    size_t capacity;
+    size_t count;
+} HistoryIndex;
+
+typedef struct {
+    char* arena;
+    size_t arena_size;
+    size_t arena_head;
+    HistoryEntry* entries;
+    size_t capacity;
+    size_t first;
+    size_t count;
+    uint32_t total;
+    HistoryIndex index;
+    int fd;
+} History;
+
 typedef struct {
     int pid;
     int ppid;
     char state;
-    char name[MAX_LINE_LENGTH];
+    unsigned long cpu_ticks;
+    long rss_pages;
+    char name[PROCESS_NAME_MAX_LENGTH];
 } ProcessInfo;
 
 typedef struct {
-    char buffer[BUFFER_SIZE];
-    char* tokens[MAX_TOKENS];
-    _Bool is_processed[MAX_TOKENS];
+    int* pids;
+    size_t count;
+    size_t capacity;
+} PidList;
+
+typedef struct {
+    ProcessInfo* processes;
+    size_t count;
+    size_t capacity;
+} ProcessList;
+
+typedef struct {
+    const char* name_pattern;
+    char state;
+    int ppid;
+    long uid;
+} ProcessFilter;
+
+typedef struct {
+    ProcessInfo info;
+    int fd;
+    _Bool changed;
+    int cpu_tenths;
+    long rss_delta;
+} ProcessSample;
+
+typedef struct {
+    int dir_fd;
+    PidList pids;
+    PidList exited;
+    ProcessSample* samples;
+    ProcessSample* previous;
+    size_t count;
+    size_t capacity;
+    size_t open_fds;
+    size_t fd_budget;
+    struct timespec taken;
+} ProcessSnapshot;
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} StatProbe;
+
+typedef struct {
+    char* buffer;
+    size_t used;
+    size_t size;
+    int fd;
+    unsigned char kind;
+    pthread_t owner;
+} Output;
+
+typedef struct {
+    struct Job* job;
+    int pid;
+    int pidfd;
+    int status;
+    _Bool done;
+} JobProcess;
+
+typedef struct Job {
+    int id;
+    char* command;
+    JobProcess* processes;
+    int process_count;
+    int running;
+    int status;
+} Job;
+
+typedef struct {
+    Job** slots;
+    int capacity;
+    int count;
+    int running;
+    int unwatched;
+    int epoll_fd;
+    int last_status;
+    _Bool limit_raised;
+} JobTable;
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t used;
+} LineArena;
+
+typedef struct {
+    char* buffer;
+    size_t buffer_size;
+    LineArena line;
+    char** tokens;
+    unsigned char* token_kinds;
+    size_t token_capacity;
     int token_count;
     FILE* input_stream;
     FILE* output_stream;
+    FILE* error_stream;
+    Output output;
     char* prompt_text;
     int debug_level;
     int exit_status;
@@ -50,16 +252,22 @@ typedef struct {
     char* procfs_path;
     _Bool is_input_redirected;
     _Bool is_output_redirected;
-    char* history[HISTORY_SIZE];
-    int history_count;
+    History history;
     _Bool block_prompt;
     int history_index;
-    Alias aliases[MAX_ALIASES];
-    int alias_count;
+    Table aliases;
+    unsigned long alias_expansion;
     char* color;
     _Bool color_active;
-    Variable variables[MAX_VARIABLES];
-    int variable_count;
+    Table variables;
+    PathCache path_cache;
+    CommandCache command_cache;
+    uint64_t line_variables;
+    int pipe_size;
+    JobTable jobs;
+    char* command_line;
+    _Bool interactive;
+    long child_max_rss;
 } Shell;
 
 #endif //MYSHELL_TYPEDEFS_H
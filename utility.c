@@ -1,38 +1,23 @@
+#define _GNU_SOURCE
 #include "utility.h"
 
 #include <stdio.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <errno.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <stdlib.h>
-
-void sigchld_handler() {
-    int pid;
-    int status;
-    int serrno;
-    serrno = errno;
-    while(1) {
-        pid = waitpid(WAIT_ANY, &status, WNOHANG);
-        if(pid <= 0)
-            break;
-    }
-
-    errno = serrno;
-}
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
 
 void remove_newline(char* str) {
     int c;
-    for(c = 0; str[c] != '\n' && str[c] != '\r'; ++c);
+    for(c = 0; str[c] != '\0' && str[c] != '\n' && str[c] != '\r'; ++c);
     str[c] = '\0';
 }
 
-char* remove_brackets(char* str) {
-    str[strlen(str) - 1] = '\0';
-    return str + 1;
-}
-
 char* trim_spaces(char* str) {
     char* end;
     while(*str != '\0' && isspace((unsigned char) *str))
@@ -53,8 +38,8 @@ int compare_int(const void* a, const void* b) {
     return (*(int*) a - *(int*) b);
 }
 
-int compare_process_info(const void* a, const void* b) {
-    return ((ProcessInfo*) a)->pid - ((ProcessInfo*) b)->pid;
+int compare_table_entries(const void* a, const void* b) {
+    return strcmp((*(TableEntry**) a)->key, (*(TableEntry**) b)->key);
 }
 
 void close_file(int fd) {
@@ -64,15 +49,132 @@ void close_file(int fd) {
     }
 }
 
-void copy_data(int input_fd, int output_fd) {
-    char buffer[BUFFER_SIZE];
+// An anonymous file in memory, used in place of a pipe where the reader only runs after the writer is done.
+// It is not inherited across exec unless dup2'd onto a standard descriptor.
+int create_memory_file(const char* name) {
+    return memfd_create(name, MFD_CLOEXEC);
+}
+
+enum {
+    COPY_DONE,
+    COPY_UNSUPPORTED,
+    COPY_FAILED,
+};
+
+static ssize_t copy_range_step(int input_fd, int output_fd, size_t length) {
+    return copy_file_range(input_fd, NULL, output_fd, NULL, length, 0);
+}
+
+static ssize_t sendfile_step(int input_fd, int output_fd, size_t length) {
+    return sendfile(output_fd, input_fd, NULL, length);
+}
+
+static ssize_t splice_step(int input_fd, int output_fd, size_t length) {
+    return splice(input_fd, NULL, output_fd, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+// No offsets are passed, so when a kernel path gives up part way the next one continues from the current file
+// positions. A path that copies nothing at all is not trusted either, since files in procfs and sysfs report
+// a size of zero and copy_file_range() then returns 0 straight away.
+static int copy_with(ssize_t (* step)(int, int, size_t), int input_fd, int output_fd) {
+    _Bool copied_any = 0;
+    for(;;) {
+        ssize_t copied = step(input_fd, output_fd, COPY_CHUNK_SIZE);
+        if(copied > 0) {
+            copied_any = 1;
+            continue;
+        }
+
+        if(copied == 0)
+            return copied_any ? COPY_DONE : COPY_UNSUPPORTED;
+
+        if(errno == EINTR)
+            continue;
+
+        if(errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP || errno == EBADF)
+            return COPY_UNSUPPORTED;
+
+        return COPY_FAILED;
+    }
+}
+
+static int write_all(int fd, const char* data, size_t length) {
+    while(length > 0) {
+        ssize_t written = write(fd, data, length);
+        if(written == -1 && errno == EINTR)
+            continue;
+
+        if(written == -1)
+            return -1;
+
+        data += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// The buffer starts small, so short inputs stay cheap, and doubles each time a read fills it.
+static int copy_buffered(int input_fd, int output_fd) {
+    size_t size = COPY_BUFFER_MIN_SIZE;
+    char* buffer = malloc(size);
     ssize_t bytes_read;
-    ssize_t bytes_written;
-    while((bytes_read = read(input_fd, buffer, BUFFER_SIZE)) > 0) {
-        bytes_written = write(output_fd, buffer, bytes_read);
-        if(bytes_written != bytes_read) {
-            perror("write");
-            exit(errno);
+    while((bytes_read = read(input_fd, buffer, size)) != 0) {
+        if(bytes_read == -1 && errno == EINTR)
+            continue;
+
+        if(bytes_read == -1) {
+            perror("read");
+            free(buffer);
+            return -1;
+        }
+
+        if(write_all(output_fd, buffer, bytes_read) == -1) {
+            if(errno != EPIPE)
+                perror("write");
+
+            free(buffer);
+            return -1;
+        }
+
+        if((size_t) bytes_read == size && size < COPY_BUFFER_MAX_SIZE) {
+            size *= 2;
+            free(buffer);
+            buffer = malloc(size);
         }
     }
+
+    free(buffer);
+    return 0;
+}
+
+// Picks the cheapest path the pair of descriptors allows: copy_file_range() between regular files, sendfile()
+// from a regular file into anything else, splice() when either side is a pipe, and a plain copy otherwise.
+int copy_data(int input_fd, int output_fd) {
+    struct stat input_stat;
+    struct stat output_stat;
+    if(fstat(input_fd, &input_stat) == 0 && fstat(output_fd, &output_stat) == 0) {
+        int result = COPY_UNSUPPORTED;
+        if(S_ISREG(input_stat.st_mode) && S_ISREG(output_stat.st_mode))
+            result = copy_with(copy_range_step, input_fd, output_fd);
+
+        if(result == COPY_UNSUPPORTED && S_ISREG(input_stat.st_mode))
+            result = copy_with(sendfile_step, input_fd, output_fd);
+
+        if(result == COPY_UNSUPPORTED && (S_ISFIFO(input_stat.st_mode) || S_ISFIFO(output_stat.st_mode)))
+            result = copy_with(splice_step, input_fd, output_fd);
+
+        // A reader that stopped early, like head, is not worth a message.
+        if(result == COPY_FAILED) {
+            if(errno != EPIPE)
+                perror("copy");
+
+            return -1;
+        }
+
+        if(result == COPY_DONE)
+            return 0;
+    }
+
+    return copy_buffered(input_fd, output_fd);
 }
\ No newline at end of file